@@ -0,0 +1,92 @@
+/***************************************************
+  Shared ownership of one I2C bus between several FreeRTOS tasks (see i2c_arbiter.h)
+ *****************************************************/
+
+#ifdef ESP32 //FreeRTOS only: host builds of the drivers don't arbitrate
+
+#include "i2c_arbiter.h"
+
+void I2CArbiter::begin(uint32_t clockHz)
+{
+  if (!_mutex) _mutex = xSemaphoreCreateRecursiveMutexStatic(&_mutexBuffer);
+  acquire();
+  _bus.begin(clockHz);
+  release();
+}
+
+void I2CArbiter::acquire(void)
+{
+  xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+}
+
+void I2CArbiter::release(void)
+{
+  xSemaphoreGiveRecursive(_mutex);
+}
+
+void I2CDevice::lock(void)
+{
+  if (_depth++ > 0) return; //Already holding the bus
+
+  const uint32_t requestTime = micros();
+  _arbiter.acquire();
+  _lockTime = micros();
+
+  const uint32_t waited = _lockTime - requestTime;
+  portENTER_CRITICAL(&_usageMux);
+  _usage.sessions++;
+  _usage.waitTime += waited;
+  if (waited > _usage.maxWaitTime) _usage.maxWaitTime = waited;
+  portEXIT_CRITICAL(&_usageMux);
+}
+
+void I2CDevice::unlock(void)
+{
+  if (_depth == 0 || --_depth > 0) return;
+
+  const uint32_t held = micros() - _lockTime;
+  _arbiter.release();
+
+  portENTER_CRITICAL(&_usageMux);
+  _usage.busyTime += held;
+  portEXIT_CRITICAL(&_usageMux);
+}
+
+bool I2CDevice::writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length)
+{
+  lock();
+  const bool ok = _arbiter.bus().writeRegisters(address, reg, src, length);
+  portENTER_CRITICAL(&_usageMux);
+  _usage.transactions++;
+  portEXIT_CRITICAL(&_usageMux);
+  unlock();
+  return ok;
+}
+
+bool I2CDevice::readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length)
+{
+  lock();
+  const bool ok = _arbiter.bus().readRegisters(address, reg, dst, length);
+  portENTER_CRITICAL(&_usageMux);
+  _usage.transactions++;
+  portEXIT_CRITICAL(&_usageMux);
+  unlock();
+  return ok;
+}
+
+I2CBusUsage I2CDevice::getUsage(void)
+{
+  portENTER_CRITICAL(&_usageMux);
+  const I2CBusUsage usage = _usage;
+  portEXIT_CRITICAL(&_usageMux);
+  return usage;
+}
+
+void I2CDevice::resetUsage(void)
+{
+  portENTER_CRITICAL(&_usageMux);
+  _usage = {0, 0, 0, 0, 0};
+  portEXIT_CRITICAL(&_usageMux);
+}
+
+#endif
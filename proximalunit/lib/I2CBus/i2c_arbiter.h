@@ -0,0 +1,80 @@
+/***************************************************
+  Shared ownership of one I2C bus between several FreeRTOS tasks.
+
+  Every device on the bus gets its own I2CDevice, which is an I2CBus itself: drivers templated on
+  the bus type (e.g. MAX86150Driver<I2CDevice>) go through the arbiter without knowing it.
+  - Each transaction holds the bus for its whole duration, so transactions of different tasks never interleave.
+  - Tasks waiting for the bus are served in priority order (FreeRTOS queues mutex waiters by priority),
+    and priority inheritance keeps a low-priority holder from being starved while a high-priority one waits:
+    at worst, an urgent task waits for the single transaction in flight.
+  - lock()/unlock() hold the bus across several transactions, so back-to-back ones (e.g. FIFO pointers +
+    FIFO burst) go out with one hand-over, and libraries that talk to Wire by themselves can be fenced off.
+  - Every device keeps track of how long it kept the bus, and how long it waited for it.
+ *****************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include "i2c_bus.h"
+
+//Bus usage of one device, since begin() or the last resetUsage()
+struct I2CBusUsage
+{
+  uint32_t transactions;
+  uint32_t sessions;    //Times the bus was taken (a lock() spanning many transactions counts once)
+  uint64_t busyTime;    //[us] the bus was held
+  uint64_t waitTime;    //[us] spent waiting for another device to release the bus
+  uint32_t maxWaitTime; //[us] longest single wait
+};
+
+class I2CArbiter {
+ public:
+  explicit I2CArbiter(I2CBus &bus) : _bus(bus) {}
+
+  void begin(uint32_t clockHz); //Starts the bus: all the devices share its clock
+  I2CBus &bus(void) { return _bus; }
+
+  void acquire(void); //Recursive: the owning task can take the bus again
+  void release(void);
+
+ private:
+  I2CBus &_bus;
+  SemaphoreHandle_t _mutex = nullptr;
+  StaticSemaphore_t _mutexBuffer;
+};
+
+//One device on an arbitrated bus. Use it from one task at a time.
+class I2CDevice final : public I2CBus {
+ public:
+  I2CDevice(I2CArbiter &arbiter, const char *name) : _arbiter(arbiter), _name(name) {}
+
+  void begin(uint32_t clockHz) override {} //The bus is started, and clocked, by I2CArbiter::begin()
+  uint16_t maxReadLength(void) override { return _arbiter.bus().maxReadLength(); }
+  bool writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length) override;
+  bool readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length) override;
+
+  void lock(void); //Holds the bus until the matching unlock(). Calls can nest
+  void unlock(void);
+
+  const char *getName(void) { return _name; }
+  I2CBusUsage getUsage(void); //Snapshot, safe to take from another task
+  void resetUsage(void);
+
+ private:
+  I2CArbiter &_arbiter;
+  const char *_name;
+  uint8_t _depth = 0; //Nesting of lock()
+  uint32_t _lockTime = 0; //micros() when the bus was obtained
+  I2CBusUsage _usage = {0, 0, 0, 0, 0};
+  portMUX_TYPE _usageMux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+//Holds the bus for the lifetime of the object
+class I2CDeviceLock {
+ public:
+  explicit I2CDeviceLock(I2CDevice &device) : _device(device) { _device.lock(); }
+  ~I2CDeviceLock() { _device.unlock(); }
+
+ private:
+  I2CDevice &_device;
+};
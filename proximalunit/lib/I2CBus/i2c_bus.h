@@ -0,0 +1,161 @@
+/***************************************************
+  Register-oriented I2C bus abstraction.
+
+  Sensor drivers only ever do two kinds of transactions: write a run of consecutive registers,
+  or point at a register and read a run of bytes back after a repeated start.
+  I2CBus exposes exactly those two, so a driver can run on the Arduino Wire library (WireBus),
+  on ESP-IDF's I2C master driver (IDFI2CBus) or on any other implementation, e.g. a simulated device on the host.
+
+  Drivers templated on the bus type call the methods of a final class directly, without virtual dispatch.
+
+  The bus is also the drivers' clock: timeouts and timestamps go through micros()/delay() of the bus,
+  so that a simulated device can run them on its own virtual time.
+ *****************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+class I2CBus {
+ public:
+  virtual ~I2CBus() {}
+
+  virtual void begin(uint32_t clockHz) = 0; //Start the bus, at the given SCL frequency [Hz]
+  virtual uint16_t maxReadLength(void) = 0; //Longest read that fits in a single transaction
+
+  //Writes `length` bytes to the registers starting at `reg` (the device auto-increments the address)
+  //Returns false if the device didn't acknowledge
+  virtual bool writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length) = 0;
+
+  //Points the device at `reg`, then reads `length` (at most maxReadLength()) bytes after a repeated start
+  //Returns false if the device didn't acknowledge or sent fewer bytes
+  virtual bool readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length) = 0;
+
+  //Time base of the drivers on this bus: the system clock on the target, nothing by default on the host
+#ifdef ARDUINO
+  virtual uint32_t micros(void) { return ::micros(); }
+  virtual void delay(uint32_t ms) { ::delay(ms); }
+#else
+  virtual uint32_t micros(void) = 0;
+  virtual void delay(uint32_t ms) = 0;
+#endif
+};
+
+#ifdef ARDUINO
+#include <Wire.h>
+
+//Define the size of the I2C buffer based on the platform the user has
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+  //I2C_BUFFER_LENGTH is defined in Wire.H
+  #define I2C_BUFFER_LENGTH BUFFER_LENGTH
+
+#elif defined(__SAMD21G18A__)
+
+  //SAMD21 uses RingBuffer.h
+  #define I2C_BUFFER_LENGTH SERIAL_BUFFER_SIZE
+
+#elif defined(ESP32)
+  #ifndef I2C_BUFFER_LENGTH
+    #define I2C_BUFFER_LENGTH 32
+  #endif
+
+#else
+
+  //The catch-all default is 32
+  #define I2C_BUFFER_LENGTH 32
+
+#endif
+
+//I2CBus on top of an Arduino TwoWire port
+class WireBus final : public I2CBus {
+ public:
+  explicit WireBus(TwoWire *port = &Wire) : _port(port) {}
+
+  void setPort(TwoWire *port) { _port = port; }
+
+  void begin(uint32_t clockHz) override {
+    _port->begin();
+    _port->setClock(clockHz);
+  }
+
+  //I2C_BUFFER_LENGTH changes based on the platform: 128 bytes on ESP32, 64 for SAMD21, 32 for Uno
+  uint16_t maxReadLength(void) override { return I2C_BUFFER_LENGTH; }
+
+  bool writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length) override {
+    _port->beginTransmission(address);
+    _port->write(reg);
+    _port->write(src, length);
+    return (_port->endTransmission() == 0);
+  }
+
+  bool readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length) override {
+    _port->beginTransmission(address);
+    _port->write(reg);
+    if (_port->endTransmission(false) != 0) return false;
+
+    if (_port->requestFrom(address, (uint8_t)length) != length) return false;
+    return (_port->readBytes(dst, length) == length);
+  }
+
+ private:
+  TwoWire *_port;
+};
+#endif
+
+#if defined(ARDUINO) && defined(ESP_PLATFORM) && defined(ESP_ARDUINO_VERSION_MAJOR) && (ESP_ARDUINO_VERSION_MAJOR == 2)
+#include <driver/i2c.h>
+#define I2C_BUS_HAS_IDF 1
+
+//I2CBus on ESP-IDF's I2C master driver: every access is a single queued command-link transaction,
+//the data lands straight in the caller's buffer, and reads have no length limit.
+//The IDF driver must already be installed on `port`: on the Arduino core (2.x), `owner.begin()` does it.
+//The command link lives in the object, so an IDFI2CBus must only be used by one task at a time.
+class IDFI2CBus final : public I2CBus {
+ public:
+  explicit IDFI2CBus(i2c_port_t port = I2C_NUM_0, TwoWire *owner = &Wire, TickType_t timeout = pdMS_TO_TICKS(50))
+    : _port(port), _owner(owner), _timeout(timeout) {}
+
+  void begin(uint32_t clockHz) override {
+    _owner->begin();
+    _owner->setClock(clockHz);
+  }
+
+  uint16_t maxReadLength(void) override { return 0xFFFF; }
+
+  bool writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length) override {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(_link, sizeof(_link));
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (address << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    if (length) i2c_master_write(cmd, src, length, true);
+    i2c_master_stop(cmd);
+    const esp_err_t err = i2c_master_cmd_begin(_port, cmd, _timeout);
+    i2c_cmd_link_delete_static(cmd);
+    return (err == ESP_OK);
+  }
+
+  bool readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length) override {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(_link, sizeof(_link));
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (address << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(cmd, reg, true);
+    i2c_master_start(cmd); //Repeated start
+    i2c_master_write_byte(cmd, (address << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, dst, length, I2C_MASTER_LAST_NACK);
+    i2c_master_stop(cmd);
+    const esp_err_t err = i2c_master_cmd_begin(_port, cmd, _timeout);
+    i2c_cmd_link_delete_static(cmd);
+    return (err == ESP_OK);
+  }
+
+ private:
+  i2c_port_t _port;
+  TwoWire *_owner;
+  TickType_t _timeout;
+  uint8_t _link[I2C_LINK_RECOMMENDED_SIZE(8)]; //START, address, register, START, address, data, STOP
+};
+#endif
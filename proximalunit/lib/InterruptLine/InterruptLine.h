@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+/* Abstraction of a sensor's interrupt output line.
+ * Sampling tasks only need to know *when* the line fires: the actual source can either be
+ * a physical GPIO of the ESP32 (GPIOInterruptLine) or a software-driven line
+ * (SimulatedInterruptLine), which allows exercising interrupt-driven acquisition on the host.
+ *
+ * The registered handler is invoked in interrupt context when the source is a GPIO:
+ * keep it short (e.g. just notify a task) and place it in IRAM.
+*/
+typedef void (*InterruptHandler)(void* arg);
+
+class InterruptLine {
+ public:
+  virtual ~InterruptLine() {}
+
+  virtual void attach(InterruptHandler handler, void* arg) = 0; // Start delivering line activations to `handler(arg)`
+  virtual void detach() = 0;
+  virtual bool isAsserted() = 0; // Current level of the line (true -> interrupt pending)
+};
+
+#ifdef ARDUINO
+/* Active-low, open-drain interrupt output wired to a GPIO pin (this is how the MAX86150 INT pin works). */
+class GPIOInterruptLine : public InterruptLine {
+ public:
+  explicit GPIOInterruptLine(uint8_t pin) : _pin(pin) {}
+
+  void attach(InterruptHandler handler, void* arg) override {
+    pinMode(_pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(_pin), handler, arg, FALLING);
+  }
+
+  void detach() override { detachInterrupt(digitalPinToInterrupt(_pin)); }
+
+  bool isAsserted() override { return digitalRead(_pin) == LOW; }
+
+ private:
+  uint8_t _pin;
+};
+#endif
+
+/* Software interrupt line: call `fire()` to emulate the falling edge of a real INT pin,
+ * and `release()` once the (simulated) device has deasserted it.
+*/
+class SimulatedInterruptLine : public InterruptLine {
+ public:
+  void attach(InterruptHandler handler, void* arg) override { _handler = handler; _arg = arg; }
+  void detach() override { _handler = nullptr; _arg = nullptr; }
+  bool isAsserted() override { return _asserted; }
+
+  void fire() {
+    const bool wasAsserted = _asserted;
+    _asserted = true;
+    if (!wasAsserted && _handler) _handler(_arg); // Edge-triggered, just like the GPIO counterpart
+  }
+  void release() { _asserted = false; }
+
+ private:
+  InterruptHandler _handler = nullptr;
+  void* _arg = nullptr;
+  volatile bool _asserted = false;
+};
@@ -8,6 +8,13 @@
  *****************************************************/
 
 #include "max86150.h"
+#include <string.h>
+#ifdef ESP32
+#include <i2c_arbiter.h>
+#endif
+#ifndef ARDUINO
+#include "max86150_sim.h"
+#endif
 
 static const uint8_t MAX86150_INTSTAT1 =		0x00;
 static const uint8_t MAX86150_INTSTAT2 =		0x01;
@@ -40,23 +47,23 @@ static const uint8_t MAX86150_PROXINTTHRESH = 	0x10;
 static const uint8_t MAX86150_PARTID = 			0xFF;
 
 // MAX86150 Commands
-static const uint8_t MAX86150_INT_A_FULL_MASK =		(byte)~0b10000000;
+static const uint8_t MAX86150_INT_A_FULL_MASK =		(uint8_t)~0b10000000;
 static const uint8_t MAX86150_INT_A_FULL_ENABLE = 	0x80;
 static const uint8_t MAX86150_INT_A_FULL_DISABLE = 	0x00;
 
-static const uint8_t MAX86150_INT_DATA_RDY_MASK = (byte)~0b01000000;
+static const uint8_t MAX86150_INT_DATA_RDY_MASK = (uint8_t)~0b01000000;
 static const uint8_t MAX86150_INT_DATA_RDY_ENABLE =	0x40;
 static const uint8_t MAX86150_INT_DATA_RDY_DISABLE = 0x00;
 
-static const uint8_t MAX86150_INT_ALC_OVF_MASK = (byte)~0b00100000;
+static const uint8_t MAX86150_INT_ALC_OVF_MASK = (uint8_t)~0b00100000;
 static const uint8_t MAX86150_INT_ALC_OVF_ENABLE = 	0x20;
 static const uint8_t MAX86150_INT_ALC_OVF_DISABLE = 0x00;
 
-static const uint8_t MAX86150_INT_PROX_INT_MASK = (byte)~0b00010000;
+static const uint8_t MAX86150_INT_PROX_INT_MASK = (uint8_t)~0b00010000;
 static const uint8_t MAX86150_INT_PROX_INT_ENABLE = 0x10;
 static const uint8_t MAX86150_INT_PROX_INT_DISABLE = 0x00;
 
-static const uint8_t MAX86150_SAMPLEAVG_MASK =	(byte)~0b11100000;
+static const uint8_t MAX86150_SAMPLEAVG_MASK =	(uint8_t)~0b11100000;
 static const uint8_t MAX86150_SAMPLEAVG_1 = 	0x00;
 static const uint8_t MAX86150_SAMPLEAVG_2 = 	0x20;
 static const uint8_t MAX86150_SAMPLEAVG_4 = 	0x40;
@@ -118,16 +125,18 @@ static const uint8_t SLOT_ECG					= 			0x0D;
 
 static const uint8_t MAX_30105_EXPECTEDPARTID = 0x1E;
 
-MAX86150::MAX86150() {
+template <class Bus>
+MAX86150Driver<Bus>::MAX86150Driver() {
   // Constructor
+  sense.head = 0;
+  sense.tail = 0;
 }
 
-boolean MAX86150::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr)
+template <class Bus>
+bool MAX86150Driver<Bus>::begin(Bus &bus, uint32_t i2cSpeed, uint8_t i2caddr)
 {
-  _i2cPort = &wirePort; //Grab which port the user wants us to use
-
-  _i2cPort->begin();
-  _i2cPort->setClock(i2cSpeed);
+  _bus = &bus;
+  _bus->begin(i2cSpeed);
 
   _i2caddr = i2caddr;
 
@@ -138,6 +147,9 @@ boolean MAX86150::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr)
     // This may mean there is a physical connectivity problem (broken wire, unpowered, etc).
     return false;
   }
+
+  // Step 2: Grab the current configuration, so that masked updates won't need to read it back
+  loadShadow();
   return true;
 }
 
@@ -146,117 +158,142 @@ boolean MAX86150::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr)
 //
 
 //Begin Interrupt configuration
-uint8_t MAX86150::getINT1(void)
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::getINT1(void)
 {
   return (readRegister8(_i2caddr, MAX86150_INTSTAT1));
 }
-uint8_t MAX86150::getINT2(void) {
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::getINT2(void) {
   return (readRegister8(_i2caddr, MAX86150_INTSTAT2));
 }
 
-void MAX86150::enableAFULL(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::enableAFULL(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_A_FULL_MASK, MAX86150_INT_A_FULL_ENABLE);
 }
-void MAX86150::disableAFULL(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::disableAFULL(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_A_FULL_MASK, MAX86150_INT_A_FULL_DISABLE);
 }
 
-void MAX86150::enableDATARDY(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::enableDATARDY(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_DATA_RDY_MASK, MAX86150_INT_DATA_RDY_ENABLE);
 }
-void MAX86150::disableDATARDY(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::disableDATARDY(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_DATA_RDY_MASK, MAX86150_INT_DATA_RDY_DISABLE);
 }
 
-void MAX86150::enableALCOVF(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::enableALCOVF(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_ALC_OVF_MASK, MAX86150_INT_ALC_OVF_ENABLE);
 }
-void MAX86150::disableALCOVF(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::disableALCOVF(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_ALC_OVF_MASK, MAX86150_INT_ALC_OVF_DISABLE);
 }
 
-void MAX86150::enablePROXINT(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::enablePROXINT(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_PROX_INT_MASK, MAX86150_INT_PROX_INT_ENABLE);
 }
-void MAX86150::disablePROXINT(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::disablePROXINT(void) {
   bitMask(MAX86150_INTENABLE1, MAX86150_INT_PROX_INT_MASK, MAX86150_INT_PROX_INT_DISABLE);
 }
 //End Interrupt configuration
 
-void MAX86150::softReset(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::softReset(void) {
   bitMask(MAX86150_SYSCONTROL, MAX86150_RESET_MASK, MAX86150_RESET);
 
   // Poll for bit to clear, reset is then complete
   // Timeout after 100ms
-  unsigned long startTime = millis();
-  while (millis() - startTime < 100)
+  const uint32_t startTime = _bus->micros();
+  while (_bus->micros() - startTime < 100000UL)
   {
     uint8_t response = readRegister8(_i2caddr, MAX86150_SYSCONTROL);
     if ((response & MAX86150_RESET) == 0) break; //We're done!
-    delay(1); //Let's not over burden the I2C bus
+    _bus->delay(1); //Let's not over burden the I2C bus
   }
+
+  // Every register is back to its power-on value: resync the shadow copy
+  loadShadow();
 }
 
-void MAX86150::shutDown(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::shutDown(void) {
   // Put IC into low power mode (datasheet pg. 19)
   // During shutdown the IC will continue to respond to I2C commands but will
   // not update with or take new readings (such as temperature)
   bitMask(MAX86150_SYSCONTROL, MAX86150_SHUTDOWN_MASK, MAX86150_SHUTDOWN);
 }
 
-void MAX86150::wakeUp(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::wakeUp(void) {
   // Pull IC out of low power mode (datasheet pg. 19)
   bitMask(MAX86150_SYSCONTROL, MAX86150_SHUTDOWN_MASK, MAX86150_WAKEUP);
 }
 
-void MAX86150::setLEDMode(uint8_t mode) {
+template <class Bus>
+void MAX86150Driver<Bus>::setLEDMode(uint8_t mode) {
   // Set which LEDs are used for sampling -- Red only, RED+IR only, or custom.
   // See datasheet, page 19
   //bitMask(MAX86150_PPGCONFIG1, MAX86150_MODE_MASK, mode);
 }
 
-void MAX86150::setADCRange(uint8_t adcRange) {
+template <class Bus>
+void MAX86150Driver<Bus>::setADCRange(uint8_t adcRange) {
   // adcRange: one of MAX86150_ADCRANGE_2048, _4096, _8192, _16384
   //bitMask(MAX86150_PARTICLECONFIG, MAX86150_ADCRANGE_MASK, adcRange);
 }
 
-void MAX86150::setSampleRate(uint8_t sampleRate) {
+template <class Bus>
+void MAX86150Driver<Bus>::setSampleRate(uint8_t sampleRate) {
   // sampleRate: one of MAX86150_SAMPLERATE_50, _100, _200, _400, _800, _1000, _1600, _3200
   //bitMask(MAX86150_PARTICLECONFIG, MAX86150_SAMPLERATE_MASK, sampleRate);
 }
 
-void MAX86150::setPulseWidth(uint8_t pulseWidth) {
+template <class Bus>
+void MAX86150Driver<Bus>::setPulseWidth(uint8_t pulseWidth) {
   // pulseWidth: one of MAX86150_PULSEWIDTH_69, _188, _215, _411
   //bitMask(MAX86150_PPGCONFIG1, MAX86150_PULSEWIDTH_MASK, pulseWidth);
 }
 
 // NOTE: Amplitude values: 0x00 = 0mA, 0x7F = 25.4mA, 0xFF = 50mA (typical)
 // See datasheet, page 21
-void MAX86150::setPulseAmplitudeRed(uint8_t amplitude)
+template <class Bus>
+void MAX86150Driver<Bus>::setPulseAmplitudeRed(uint8_t amplitude)
 {
-  writeRegister8(_i2caddr, MAX86150_LED2_PULSEAMP, amplitude);
+  setRegister(MAX86150_LED2_PULSEAMP, amplitude);
 }
 
-void MAX86150::setPulseAmplitudeIR(uint8_t amplitude)
+template <class Bus>
+void MAX86150Driver<Bus>::setPulseAmplitudeIR(uint8_t amplitude)
 {
-  writeRegister8(_i2caddr, MAX86150_LED1_PULSEAMP, amplitude);
+  setRegister(MAX86150_LED1_PULSEAMP, amplitude);
 }
 
-void MAX86150::setPulseAmplitudeProximity(uint8_t amplitude) {
-  writeRegister8(_i2caddr, MAX86150_LED_PROX_AMP, amplitude);
+template <class Bus>
+void MAX86150Driver<Bus>::setPulseAmplitudeProximity(uint8_t amplitude) {
+  setRegister(MAX86150_LED_PROX_AMP, amplitude);
 }
 
-void MAX86150::setProximityThreshold(uint8_t threshMSB)
+template <class Bus>
+void MAX86150Driver<Bus>::setProximityThreshold(uint8_t threshMSB)
 {
   // The threshMSB signifies only the 8 most significant-bits of the ADC count.
-  writeRegister8(_i2caddr, MAX86150_PROXINTTHRESH, threshMSB);
+  setRegister(MAX86150_PROXINTTHRESH, threshMSB);
 }
 
 //Given a slot number assign a thing to it
 //Devices are SLOT_RED_LED or SLOT_RED_PILOT (proximity)
 //Assigning a SLOT_RED_LED will pulse LED
 //Assigning a SLOT_RED_PILOT will ??
-void MAX86150::enableSlot(uint8_t slotNumber, uint8_t device)
+template <class Bus>
+void MAX86150Driver<Bus>::enableSlot(uint8_t slotNumber, uint8_t device)
 {
 	  //uint8_t originalContents;
 
@@ -280,89 +317,114 @@ void MAX86150::enableSlot(uint8_t slotNumber, uint8_t device)
 }
 
 //Clears all slot assignments
-void MAX86150::disableSlots(void)
+template <class Bus>
+void MAX86150Driver<Bus>::disableSlots(void)
 {
-  writeRegister8(_i2caddr, MAX86150_FIFOCONTROL1, 0);
-  writeRegister8(_i2caddr, MAX86150_FIFOCONTROL2, 0);
+  setRegister(MAX86150_FIFOCONTROL1, 0);
+  setRegister(MAX86150_FIFOCONTROL2, 0);
 }
 
 //
 // FIFO Configuration
 //
 
-void MAX86150::setFIFOAverage(uint8_t numberOfSamples)
+template <class Bus>
+void MAX86150Driver<Bus>::setFIFOAverage(uint8_t numberOfSamples)
 {
   bitMask(MAX86150_FIFOCONFIG, MAX86150_SAMPLEAVG_MASK, numberOfSamples);
 }
 
 //Resets all points to start in a known state
-void MAX86150::clearFIFO(void) {
-  writeRegister8(_i2caddr, MAX86150_FIFOWRITEPTR, 0);
-  writeRegister8(_i2caddr, MAX86150_FIFOOVERFLOW, 0);
-  writeRegister8(_i2caddr, MAX86150_FIFOREADPTR, 0);
+template <class Bus>
+void MAX86150Driver<Bus>::clearFIFO(void) {
+  //FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR are contiguous: zero them in a single burst
+  const uint8_t zeros[3] = {0, 0, 0};
+  writeRegisters(MAX86150_FIFOWRITEPTR, zeros, sizeof(zeros));
 }
 
 //Enable roll over if FIFO over flows
-void MAX86150::enableFIFORollover(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::enableFIFORollover(void) {
   bitMask(MAX86150_FIFOCONFIG, MAX86150_ROLLOVER_MASK, MAX86150_ROLLOVER_ENABLE);
 }
 
 //Disable roll over if FIFO over flows
-void MAX86150::disableFIFORollover(void) {
+template <class Bus>
+void MAX86150Driver<Bus>::disableFIFORollover(void) {
   bitMask(MAX86150_FIFOCONFIG, MAX86150_ROLLOVER_MASK, MAX86150_ROLLOVER_DISABLE);
 }
 
 //Power on default is 32 samples
 //Note it is reverse: 0x00 is 32 samples, 0x0F is 17 samples
-void MAX86150::setFIFOAlmostFull(uint8_t numberOfSamples) {
+template <class Bus>
+void MAX86150Driver<Bus>::setFIFOAlmostFull(uint8_t numberOfSamples) {
   bitMask(MAX86150_FIFOCONFIG, MAX86150_A_FULL_MASK, numberOfSamples);
 }
 
 //Read the FIFO Write Pointer
-uint8_t MAX86150::getWritePointer(void) {
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::getWritePointer(void) {
   return (readRegister8(_i2caddr, MAX86150_FIFOWRITEPTR));
 }
 
 //Read the FIFO Read Pointer
-uint8_t MAX86150::getReadPointer(void) {
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::getReadPointer(void) {
   return (readRegister8(_i2caddr, MAX86150_FIFOREADPTR));
 }
 
 // Set the PROX_INT_THRESHold
-void MAX86150::setPROXINTTHRESH(uint8_t val) {
-  writeRegister8(_i2caddr, MAX86150_PROXINTTHRESH, val);
+template <class Bus>
+void MAX86150Driver<Bus>::setPROXINTTHRESH(uint8_t val) {
+  setRegister(MAX86150_PROXINTTHRESH, val);
 }
 
 //
 // Device ID and Revision
 //
-uint8_t MAX86150::readPartID() {
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::readPartID() {
   return readRegister8(_i2caddr, MAX86150_PARTID);
 }
 
-// Setup the sensor
-void MAX86150::setup(byte powerLevel, byte sampleAverage, byte ledMode, int sampleRate, int pulseWidth, int adcRange) {
-  activeDevices = 3;
-  writeRegister8(_i2caddr,MAX86150_SYSCONTROL,0x01);
-  delay(100);
-  writeRegister8(_i2caddr,MAX86150_FIFOCONFIG,0x7F);
-
-  //FIFO Configuration
-  //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-  //The chip will average multiple samples of same type together if you wish
-  if (sampleAverage == 1) setFIFOAverage(MAX86150_SAMPLEAVG_1); // No averaging per FIFO record
-  else if (sampleAverage == 2) setFIFOAverage(MAX86150_SAMPLEAVG_2);
-  else if (sampleAverage == 4) setFIFOAverage(MAX86150_SAMPLEAVG_4);
-  else if (sampleAverage == 8) setFIFOAverage(MAX86150_SAMPLEAVG_8);
-  else if (sampleAverage == 16) setFIFOAverage(MAX86150_SAMPLEAVG_16);
-  else if (sampleAverage == 32) setFIFOAverage(MAX86150_SAMPLEAVG_32);
-  else setFIFOAverage(MAX86150_SAMPLEAVG_4);
+// Setup the sensor with run-time settings
+// Units are the MAX86150's: sampleRate [sps] (applied to both ECG and PPG), pulseWidth [us], adcRange [nA]
+// Returns false, without touching the sensor, if the combination is not supported (see max86150cfg::isValid())
+// ledMode: 1 or 2 --> PPG only (IR + Red), 3 --> PPG + ECG
+template <class Bus>
+bool MAX86150Driver<Bus>::setup(uint8_t powerLevel, uint8_t sampleAverage, uint8_t ledMode, int sampleRate, int pulseWidth, int adcRange) {
+  const max86150cfg::Settings settings = {
+    (uint16_t)sampleRate, (uint16_t)sampleRate, sampleAverage, (uint16_t)pulseWidth, (uint16_t)adcRange,
+    8, 95, powerLevel, 50, 15, // ECG gain 9.5 * 8 V/V, LEDs at 50mA, A_FULL with 15 free slots
+    (ledMode > 2) ? MAX86150_CHANNELS_PPG_ECG : MAX86150_CHANNELS_PPG
+  };
+  if (!max86150cfg::isValid(settings)) return false;
+
+  setup(max86150cfg::build(settings));
+  return true;
+}
+
+// Setup the sensor with a full set of register values, usually computed at compile time by MAX86150Config<...>
+template <class Bus>
+void MAX86150Driver<Bus>::setup(const MAX86150Registers &config) {
+  activeDevices = config.activeDevices;
+  channels = config.channels;
+  ecgRate = config.ecgRate;
+  ppgRate = config.ppgRate;
+  samplePeriod = 1000000UL / getFIFORate();
+  softReset(); //Also reloads the register shadow with the post-reset contents
+
+  //Stage the whole configuration in the shadow registers, then flush it in a few burst writes
+  beginConfig();
+
+  /* Set Register `FIFO Configuration`
+    * A_FULL_TYPE [bit #6] | FIFO_STAT_CLR [bit #5] | FIFO_ROLLS_ON_FULL [bit #4] | FIFO_A_FULL [bits 3:0]
+  */
+  setRegister(MAX86150_FIFOCONFIG, config.fifoConfig);
 
   /* Set Registers `FIFO Control 1/2`
     * Those allow choosing which data the FIFO register should hold
     * Every sample in FIFO can contain up to 4 data FD1/FD2/FD3/FD4
-    * Setup the FIFO to hold data from: LED1 | LED2 | ECG | not used
-    * .................................. FD1 |  FD2 | FD3 |  FD4
     * 
     * FIFO Control 1 = FD2|FD1, FIFO Control 2 = FD4|FD3
     * FDx options: 0001 -> PPG LED 1
@@ -371,28 +433,26 @@ void MAX86150::setup(byte powerLevel, byte sampleAverage, byte ledMode, int samp
     *              0101 -> Pilot LED 1
     *              0110 -> Pilot LED 2
   */
-  writeRegister8(_i2caddr,MAX86150_FIFOCONTROL1,(0b00100001));
-  writeRegister8(_i2caddr,MAX86150_FIFOCONTROL2,(0b00001001));
+  setRegister(MAX86150_FIFOCONTROL1, config.fifoControl1);
+  setRegister(MAX86150_FIFOCONTROL2, config.fifoControl2);
 
   /* Set Register `PPG Configuration 1`
     * __MSB__
-    * SpO2 ADC Range [2 bits]: 11 --> 62pA LSB and 32768nA FSR
-    * SpO2 Sample Rate [4 bits]: 0101 --> 200 samples/s and 1 pulse/sample
-    * LED Pulse Width [2 bits]: 01 --> pulsewidth 100us and integrationtime 100us and 19bits resolution
+    * SpO2 ADC Range [2 bits] | SpO2 Sample Rate [4 bits] | LED Pulse Width [2 bits]
   */
-  writeRegister8(_i2caddr,MAX86150_PPGCONFIG1,0b11010101);
+  setRegister(MAX86150_PPGCONFIG1, config.ppgConfig1);
 
-  /* Set Register `PPG Configuration 1`
-    * PPG Sample Averaging [3 LS bits]: 0b001 --> Average on 2 PPG samples
+  /* Set Register `PPG Configuration 2`
+    * PPG Sample Averaging [3 LS bits]
   */
-  writeRegister8(_i2caddr,MAX86150_PPGCONFIG2, 0b00000001);
+  setRegister(MAX86150_PPGCONFIG2, config.ppgConfig2);
 
   /* Set Register `LED Range`
     * LED_RANGE [4 least significant bits] = LED2_RGE[2 bits] | LED1_RGE[2 bits]
     * Options for each LED: 00 -> 50 mA
     *                       01 -> 100 mA
   */
-  writeRegister8(_i2caddr,MAX86150_LED_RANGE, 0x00 );
+  setRegister(MAX86150_LED_RANGE, config.ledRange);
 
   /* Set Register `System Control`
     * FIFO Enable [bit #2]: 1 --> FIFO Enabled
@@ -400,276 +460,526 @@ void MAX86150::setup(byte powerLevel, byte sampleAverage, byte ledMode, int samp
     * Reset [bit #0]: 0 --> Normal Operation (If 1, the MAX86150 will undergo a reset cycle)
     * __LSB__
   */
-  writeRegister8(_i2caddr, MAX86150_SYSCONTROL, 0x04);//start FIFO
+  setRegister(MAX86150_SYSCONTROL, 0x04);//start FIFO
 
   /* Set Register `ECG Configuration 1`
-    * ECG ADC Settings
-    *
     * ECG ADC CLK | ECG ADC Oversampling Ratio [bits 2|1 0]
-    * . Set to 011 --> ECG Samplerate 200Hz, Filter BW @70% 52Hz, Filter BW @90% 29Hz
-    * 
-    * See other options at page 34 of the datasheet
+    * See options at page 34 of the datasheet
   */
-  writeRegister8(_i2caddr,MAX86150_ECG_CONFIG1,0b00000011); // SR: 200
+  setRegister(MAX86150_ECG_CONFIG1, config.ecgConfig1);
 
   /* Set Register `ECG Configuration 3
-    * ECG Gain Settings
-    *
-    * ECG PGA Gain [2 bits]: 11 --> 8 V/V
-    * ECG INA Gain [2 bits]: 01 --> 9.5 V/V
-    * __LSB__
-    * 
-    * page 35 datasheet for other options
+    * ECG PGA Gain [2 bits] | ECG INA Gain [2 bits]
+    * page 35 datasheet for options
   */
-  writeRegister8(_i2caddr,MAX86150_ECG_CONFIG3,0b00001101); // IA Gain: 9.5 / PGA Gain: 8
-
-  setPulseAmplitudeRed(0xFF);
-  setPulseAmplitudeIR(0xFF);
-
-  //Multi-LED Mode Configuration, Enable the reading of the three LEDs
-  //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-  //enableSlot(1, SLOT_RED_LED);
-  //if (ledMode > 1)
-  //enableSlot(2, SLOT_IR_LED);
-  //if (ledMode > 2)
-  //enableSlot(3, SLOT_ECG);
-  //enableSlot(1, SLOT_RED_PILOT);
-  //enableSlot(2, SLOT_IR_PILOT);
-  //enableSlot(3, SLOT_GREEN_PILOT);
-  //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+  setRegister(MAX86150_ECG_CONFIG3, config.ecgConfig3);
+
+  setPulseAmplitudeRed(config.led2Amplitude);
+  setPulseAmplitudeIR(config.led1Amplitude);
+
+  commitConfig(); //Writes FIFO config/controls, system control + PPG/LED settings, ECG settings in contiguous bursts
 
   clearFIFO(); //Reset the FIFO before we begin checking the sensor
 }
 
-//Tell caller how many samples are available
-uint8_t MAX86150::available(void)
+//Selects which channels the FIFO holds, without touching any other setting
+//FIFO_CONTROL1/2 are rewritten in one burst, and the FIFO is flushed, as its records have the old layout
+//In PPG + ECG mode, the ECG and PPG rates must match (see MAX86150Config)
+template <class Bus>
+void MAX86150Driver<Bus>::setChannels(MAX86150Channels newChannels)
+{
+  beginConfig();
+  setRegister(MAX86150_FIFOCONTROL1, max86150cfg::fifoControl1(newChannels));
+  setRegister(MAX86150_FIFOCONTROL2, max86150cfg::fifoControl2(newChannels));
+  commitConfig();
+
+  channels = newChannels;
+  activeDevices = max86150cfg::activeDevices(newChannels);
+  samplePeriod = 1000000UL / getFIFORate();
+  clearFIFO();
+  sense.tail = sense.head; //Samples still waiting in the sense array were unpacked with the old layout: drop them too
+}
+
+template <class Bus>
+MAX86150Channels MAX86150Driver<Bus>::getChannels(void)
 {
-  int8_t numberOfSamples = sense.head - sense.tail;
-  if (numberOfSamples < 0) numberOfSamples += STORAGE_SIZE;
+  return (channels);
+}
 
-  return (numberOfSamples);
+//FIFO records per second with the current configuration
+template <class Bus>
+uint16_t MAX86150Driver<Bus>::getFIFORate(void)
+{
+  return (max86150cfg::fifoRate(channels, ecgRate, ppgRate));
+}
+
+//Tell caller how many samples are available
+template <class Bus>
+uint16_t MAX86150Driver<Bus>::available(void)
+{
+  return (uint16_t)(sense.head - sense.tail); //Counters are free-running, unsigned arithmetic handles the wrap
 }
 
 //Report the most recent red value
-uint32_t MAX86150::getRed(void)
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getRed(void)
 {
   //Check the sensor for new data for 250ms
   if(safeCheck(250))
-    return (sense.red[sense.head]);
+    return (getLatestRed());
   else
     return(0); //Sensor failed to find new data
 }
 
 //Report the most recent IR value
-uint32_t MAX86150::getIR(void)
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getIR(void)
 {
   //Check the sensor for new data for 250ms
   if(safeCheck(250))
-    return (sense.IR[sense.head]);
+    return (getLatestIR());
   else
     return(0); //Sensor failed to find new data
 }
 
 //Report the most recent Green value
-int32_t MAX86150::getECG(void)
+template <class Bus>
+int32_t MAX86150Driver<Bus>::getECG(void)
 {
   //Check the sensor for new data for 250ms
   if(safeCheck(250))
-    return (sense.ecg[sense.head]);
+    return (getLatestECG());
   else
     return(0); //Sensor failed to find new data
 }
 
+//Report the most recent values already in the sense array, without polling the sensor
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getLatestRed(void)
+{
+  return (sense.red[(sense.head - 1) & sense_struct::MASK]);
+}
+
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getLatestIR(void)
+{
+  return (sense.IR[(sense.head - 1) & sense_struct::MASK]);
+}
+
+template <class Bus>
+int32_t MAX86150Driver<Bus>::getLatestECG(void)
+{
+  return (sense.ecg[(sense.head - 1) & sense_struct::MASK]);
+}
+
+//Arm a non-blocking read: pollSample() will report READY as soon as new data shows up,
+//or TIMEOUT once `timeoutMs` have passed without any
+template <class Bus>
+void MAX86150Driver<Bus>::requestSample(uint16_t timeoutMs)
+{
+  readStatus = MAX86150_READ_PENDING;
+  readRequestTime = _bus->micros();
+  readTimeout = timeoutMs;
+}
+
+//Advance the armed read by one step: at most one check(), and no waiting
+//This is the non-blocking version of safeCheck()
+template <class Bus>
+MAX86150ReadStatus MAX86150Driver<Bus>::pollSample(void)
+{
+  if (readStatus != MAX86150_READ_PENDING)
+    return (MAX86150_READ_IDLE); //Nothing was requested
+
+  if (check() > 0)
+  {
+    readStatus = MAX86150_READ_IDLE;
+    return (MAX86150_READ_READY); //We found new data!
+  }
+  if (_bus->micros() - readRequestTime > readTimeout * 1000UL)
+  {
+    readStatus = MAX86150_READ_IDLE;
+    return (MAX86150_READ_TIMEOUT); //Sensor failed to find new data
+  }
+  return (MAX86150_READ_PENDING);
+}
+
 //Report the next Red value in the FIFO
-uint32_t MAX86150::getFIFORed(void)
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getFIFORed(void)
 {
-  return (sense.red[sense.tail]);
+  return (sense.red[sense.tail & sense_struct::MASK]);
 }
 
 //Report the next IR value in the FIFO
-uint32_t MAX86150::getFIFOIR(void)
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getFIFOIR(void)
 {
-  return (sense.IR[sense.tail]);
+  return (sense.IR[sense.tail & sense_struct::MASK]);
 }
 
 //Report the next Green value in the FIFO
-int32_t MAX86150::getFIFOECG(void)
+template <class Bus>
+int32_t MAX86150Driver<Bus>::getFIFOECG(void)
+{
+  return (sense.ecg[sense.tail & sense_struct::MASK]);
+}
+
+//Report the timestamp of the next sample in the FIFO
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getFIFOTimestamp(void)
+{
+  return (sense.timestamp[sense.tail & sense_struct::MASK]);
+}
+
+//Samples lost because the sensor's FIFO filled up before check() was called
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getFIFOOverflows(void)
+{
+  return (fifoOverflows);
+}
+
+//Samples lost because the sense array filled up before the user consumed them
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getRingOverflows(void)
 {
-  return (sense.ecg[sense.tail]);
+  return (ringOverflows);
+}
+
+template <class Bus>
+uint32_t MAX86150Driver<Bus>::getDroppedSamples(void)
+{
+  return (fifoOverflows + ringOverflows);
+}
+
+template <class Bus>
+void MAX86150Driver<Bus>::resetDropCounters(void)
+{
+  fifoOverflows = 0;
+  ringOverflows = 0;
 }
 
 //Advance the tail
-void MAX86150::nextSample(void)
+template <class Bus>
+void MAX86150Driver<Bus>::nextSample(void)
 {
   if(available()) //Only advance the tail if new data is available
   {
     sense.tail++;
-    sense.tail %= STORAGE_SIZE; //Wrap condition
   }
 }
 
+//Copy up to `maxSamples` pending samples, oldest first, into the caller's arrays and consume them
+//Pass nullptr for the channels you are not interested in (and for `timestamps`, if you don't need them)
+//Returns the number of samples copied
+template <class Bus>
+uint16_t MAX86150Driver<Bus>::drain(int32_t *ecg, uint32_t *ir, uint32_t *red, uint16_t maxSamples, uint32_t *timestamps)
+{
+  uint16_t toCopy = available();
+  if (toCopy > maxSamples) toCopy = maxSamples;
+
+  //The pending samples are at most two contiguous runs: [tail, end of ring) and [0, rest)
+  uint16_t first = sense.tail & sense_struct::MASK;
+  uint16_t firstRun = sense_struct::SIZE - first;
+  if (firstRun > toCopy) firstRun = toCopy;
+  uint16_t secondRun = toCopy - firstRun;
+
+  if (ecg)
+  {
+    memcpy(ecg, &sense.ecg[first], firstRun * sizeof(int32_t));
+    memcpy(ecg + firstRun, sense.ecg, secondRun * sizeof(int32_t));
+  }
+  if (ir)
+  {
+    memcpy(ir, &sense.IR[first], firstRun * sizeof(uint32_t));
+    memcpy(ir + firstRun, sense.IR, secondRun * sizeof(uint32_t));
+  }
+  if (red)
+  {
+    memcpy(red, &sense.red[first], firstRun * sizeof(uint32_t));
+    memcpy(red + firstRun, sense.red, secondRun * sizeof(uint32_t));
+  }
+  if (timestamps)
+  {
+    memcpy(timestamps, &sense.timestamp[first], firstRun * sizeof(uint32_t));
+    memcpy(timestamps + firstRun, sense.timestamp, secondRun * sizeof(uint32_t));
+  }
+
+  sense.tail += toCopy;
+  return (toCopy);
+}
+
 //Polls the sensor for new data
 //Call regularly
 //If new data is available, it updates the head and tail in the main struct
 //Returns number of new samples obtained
-uint16_t MAX86150::check(void)
+template <class Bus>
+uint16_t MAX86150Driver<Bus>::check(void)
 {
   //Read register FIFO_DATA in (3-byte * number of active LED) chunks
   //Until FIFO_RD_PTR = FIFO_WR_PTR
 
-  byte readPointer = getReadPointer();
-  byte writePointer = getWritePointer();
+  //FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR are contiguous: get them in a single burst
+  uint8_t pointers[3];
+  readRegisters(MAX86150_FIFOWRITEPTR, pointers, sizeof(pointers));
+  const uint32_t readTime = _bus->micros(); //The newest record in the FIFO was taken at most one sample period ago
+  uint8_t writePointer = pointers[0] & 0x1F;
+  uint8_t overflowCount = pointers[1] & 0x1F;
+  uint8_t readPointer = pointers[2] & 0x1F;
 
   int numberOfSamples = 0;
 
+  //OVF_COUNTER is non-zero only while the FIFO is full: the pointers match, but there are 32 records to read
+  if (overflowCount > 0)
+  {
+    fifoOverflows += overflowCount; //Saturates at 31: a longer stall under-counts
+    numberOfSamples = MAX86150_FIFO_DEPTH;
+  }
   //Do we have new data?
-  if (readPointer != writePointer)
+  else if (readPointer != writePointer)
   {
     //Calculate the number of readings we need to get from sensor
     numberOfSamples = writePointer - readPointer;
     if (numberOfSamples < 0) numberOfSamples += 32; //Wrap condition
+  }
 
+  if (numberOfSamples > 0)
+  {
     //We now have the number of readings, now calc bytes to read
-    //For this example we are just doing Red and IR (3 bytes each)
-    int bytesLeftToRead = numberOfSamples * activeDevices * 3;
-
-    //Get ready to read a burst of data from the FIFO register
-    _i2cPort->beginTransmission(_i2caddr);
-    _i2cPort->write(MAX86150_FIFODATA);
-    _i2cPort->endTransmission();
-
-    //We may need to read as many as 288 bytes so we read in blocks no larger than I2C_BUFFER_LENGTH
-    //I2C_BUFFER_LENGTH changes based on the platform. 64 bytes for SAMD21, 32 bytes for Uno.
-    //Wire.requestFrom() is limited to BUFFER_LENGTH which is 32 on the Uno
-    while (bytesLeftToRead > 0)
-    {
-      int toGet = bytesLeftToRead;
-      if (toGet > I2C_BUFFER_LENGTH)
-      {
-        //If toGet is 32 this is bad because we read 6 bytes (Red+IR * 3 = 6) at a time
-        //32 % 6 = 2 left over. We don't want to request 32 bytes, we want to request 30.
-        //32 % 9 (Red+IR+GREEN) = 5 left over. We want to request 27.
+    //Each active device (Red, IR, ECG) takes 3 bytes per sample
+    int bytesToRead = numberOfSamples * activeDevices * 3;
 
-        toGet = I2C_BUFFER_LENGTH - (I2C_BUFFER_LENGTH % (activeDevices * 3)); //Trim toGet to be a multiple of the samples we need to read
-      }
-
-      bytesLeftToRead -= toGet;
-
-      //Request toGet number of bytes from sensor
-      _i2cPort->requestFrom(_i2caddr, toGet);
-
-      while (toGet > 0)
-      {
-        sense.head++; //Advance the head of the storage struct
-        sense.head %= STORAGE_SIZE; //Wrap condition
-
-        byte temp[sizeof(uint32_t)]; //Array of 4 bytes that we will convert into long
-        uint32_t tempLong;
-
-        //Burst read three bytes - RED
-        temp[3] = 0;
-        temp[2] = _i2cPort->read();
-        temp[1] = _i2cPort->read();
-        temp[0] = _i2cPort->read();
-
-        //Convert array to long
-        memcpy(&tempLong, temp, sizeof(tempLong));
+    //Read the whole burst in one go, then unpack it
+    readFIFOBurst(fifoBuffer, bytesToRead);
+    unpackFIFO(fifoBuffer, numberOfSamples, readTime);
+  } //End numberOfSamples > 0
+  return (numberOfSamples); //Let the world know how much new data we found
+}
 
-				tempLong &= 0x7FFFF; //Zero out all but 19 bits
+//Reads `length` bytes (up to a full FIFO) from register FIFO_DATA into `dst`
+//The transfer is split in as few I2C transactions as the platform's Wire buffer allows
+template <class Bus>
+void MAX86150Driver<Bus>::readFIFOBurst(uint8_t *dst, int length)
+{
+  //The bus buffer changes based on the platform: 128 bytes on ESP32, 64 for SAMD21, 32 for Uno.
+  //Keep every transaction a multiple of the record size, so no sample is split across two of them.
+  //FIFO_DATA doesn't auto-increment, so every chunk keeps reading from the FIFO.
+  const int recordSize = activeDevices * 3;
+  const int maxRead = _bus->maxReadLength();
+  const int maxChunk = maxRead - (maxRead % recordSize);
+
+  while (length > 0)
+  {
+    int toGet = (length > maxChunk) ? maxChunk : length;
+    _bus->readRegisters(_i2caddr, MAX86150_FIFODATA, dst, toGet);
 
-        sense.red[sense.head] = tempLong; //Store this reading into the sense array
+    dst += toGet;
+    length -= toGet;
+  }
+}
 
-        if (activeDevices > 1)
-        {
-          //Burst read three more bytes - IR
-          temp[3] = 0;
-          temp[2] = _i2cPort->read();
-          temp[1] = _i2cPort->read();
-          temp[0] = _i2cPort->read();
+//Each FIFO datum is 3 bytes, MSB first
+static inline uint32_t unpack24(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[2];
+}
 
-          //Convert array to long
-          memcpy(&tempLong, temp, sizeof(tempLong));
-					//Serial.println(tempLong);
-				  tempLong &= 0x7FFFF; //Zero out all but 19 bits
+//PPG data is 19 bits wide, unsigned
+static inline uint32_t unpackPPG(const uint8_t *p)
+{
+  return unpack24(p) & 0x7FFFF;
+}
 
-				  sense.IR[sense.head] = tempLong;
-        }
+//ECG data is 18 bits wide, two's complement: move its sign bit (#17) to bit #31, then shift it back arithmetically
+static inline int32_t unpackECG(const uint8_t *p)
+{
+  return (int32_t)(unpack24(p) << 14) >> 14;
+}
 
-        if (activeDevices > 2)
-        {
-          //Burst read three more bytes - ECG
-					int32_t tempLongSigned;
+//Block kernel: converts `numberOfSamples` raw FIFO records into the sense array.
+//The record layout (see MAX86150Channels) is resolved once per burst, so every loop below is branch-free.
+//The sensor samples at a fixed rate, so the timestamps are reconstructed backwards from the newest record, taken at `lastTimestamp`
+template <class Bus>
+void MAX86150Driver<Bus>::unpackFIFO(const uint8_t *src, int numberOfSamples, uint32_t lastTimestamp)
+{
+  uint16_t head = sense.head;
 
-          temp[3] = 0;
-          temp[2] = _i2cPort->read();
-          temp[1] = _i2cPort->read();
-          temp[0] = _i2cPort->read();
-					//Serial.println(tempLong);
-          //Convert array to long
-          memcpy(&tempLongSigned, temp, sizeof(tempLongSigned));
+  uint32_t timestamp = lastTimestamp - (uint32_t)(numberOfSamples - 1) * samplePeriod;
+  for (int i = 0; i < numberOfSamples; i++, timestamp += samplePeriod)
+  {
+    sense.timestamp[(head + i) & sense_struct::MASK] = timestamp;
+  }
 
-		  		//tempLong &= 0x3FFFF; //Zero out all but 18 bits (Not needed bc ECG `don't care` bits are already set to 0 by the MAX86150)
+  switch (channels)
+  {
+    case MAX86150_CHANNELS_PPG_ECG: //IR | Red | ECG
+      for (int i = 0; i < numberOfSamples; i++, src += 9, head++)
+      {
+        const uint16_t slot = head & sense_struct::MASK;
+        sense.IR[slot] = unpackPPG(src);
+        sense.red[slot] = unpackPPG(src + 3);
+        sense.ecg[slot] = unpackECG(src + 6);
+      }
+      break;
+    case MAX86150_CHANNELS_PPG: //IR | Red
+      for (int i = 0; i < numberOfSamples; i++, src += 6, head++)
+      {
+        const uint16_t slot = head & sense_struct::MASK;
+        sense.IR[slot] = unpackPPG(src);
+        sense.red[slot] = unpackPPG(src + 3);
+      }
+      break;
+    case MAX86150_CHANNELS_ECG: //ECG
+      for (int i = 0; i < numberOfSamples; i++, src += 3, head++)
+      {
+        sense.ecg[head & sense_struct::MASK] = unpackECG(src);
+      }
+      break;
+  }
 
-          sense.ecg[sense.head] = tempLongSigned;
-        }
+  sense.head = head;
 
-        toGet -= activeDevices * 3;
-      }
-    } //End while (bytesLeftToRead > 0)
-  } //End readPtr != writePtr
-  return (numberOfSamples); //Let the world know how much new data we found
+  //If the user fell behind by more than a whole ring, the oldest samples have just been overwritten
+  const uint16_t pending = sense.head - sense.tail;
+  if (pending > sense_struct::SIZE)
+  {
+    ringOverflows += pending - sense_struct::SIZE;
+    sense.tail = sense.head - sense_struct::SIZE;
+  }
 }
 
 //Check for new data but give up after a certain amount of time
 //Returns true if new data was found
 //Returns false if new data was not found
-bool MAX86150::safeCheck(uint8_t maxTimeToCheck)
+template <class Bus>
+bool MAX86150Driver<Bus>::safeCheck(uint8_t maxTimeToCheck)
 {
-  uint32_t markTime = millis();
+  uint32_t markTime = _bus->micros();
 
   while(1)
   {
-	if(millis() - markTime > maxTimeToCheck) return(false);
+	if(_bus->micros() - markTime > maxTimeToCheck * 1000UL) return(false);
 
-	if(check() == true) //We found new data!
+	if(check() > 0) //We found new data! (a whole burst, with A_FULL)
 	  return(true);
 
-	delay(1);
+	_bus->delay(1);
   }
 }
 
-//Given a register, read it, mask it, and then set the thing
-void MAX86150::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
+//Given a register, mask its shadow copy, and then set the thing
+//No read-back over I2C is needed, as the shadow always mirrors the configuration registers
+template <class Bus>
+void MAX86150Driver<Bus>::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
 {
-  // Grab current register context
-  uint8_t originalContents = readRegister8(_i2caddr, reg);
-
-  // Zero-out the portions of the register we're interested in
-  originalContents = originalContents & mask;
+  // Zero-out the portions of the register we're interested in, then change contents
+  setRegister(reg, (shadow[reg] & mask) | thing);
+}
 
-  // Change contents
-  writeRegister8(_i2caddr, reg, originalContents | thing);
+//Reloads the shadow copy of the configuration registers from the sensor, in one burst per contiguous block
+//Status and FIFO registers (0x00-0x01, 0x04-0x07) are skipped on purpose: reading them has side effects
+template <class Bus>
+void MAX86150Driver<Bus>::loadShadow(void)
+{
+  readRegisters(MAX86150_INTENABLE1, &shadow[MAX86150_INTENABLE1], MAX86150_INTENABLE2 - MAX86150_INTENABLE1 + 1);
+  readRegisters(MAX86150_FIFOCONFIG, &shadow[MAX86150_FIFOCONFIG], MAX86150_FIFOCONTROL2 - MAX86150_FIFOCONFIG + 1);
+  readRegisters(MAX86150_SYSCONTROL, &shadow[MAX86150_SYSCONTROL], MAX86150_LED_PILOT_PA - MAX86150_SYSCONTROL + 1);
+  readRegisters(MAX86150_ECG_CONFIG1, &shadow[MAX86150_ECG_CONFIG1], MAX86150_ECG_CONFIG3 - MAX86150_ECG_CONFIG1 + 1);
+  dirtyRegisters = 0;
 }
 
-uint8_t MAX86150::readRegister8(uint8_t address, uint8_t reg) {
+//From now on, configuration writes only update the shadow registers, until commitConfig() is called
+template <class Bus>
+void MAX86150Driver<Bus>::beginConfig(void)
+{
+  stagingConfig = true;
+}
 
-	//uint8_t tempData = 0;
-  _i2cPort->beginTransmission(address);
-  _i2cPort->write(reg);
-  _i2cPort->endTransmission(false);
+//Flushes every register changed since beginConfig(): runs of contiguous registers go out as one auto-increment burst
+template <class Bus>
+void MAX86150Driver<Bus>::commitConfig(void)
+{
+  stagingConfig = false;
 
-  _i2cPort->requestFrom((uint8_t)address, (uint8_t)1); // Request 1 byte
-  if (_i2cPort->available())
+  uint8_t reg = 0;
+  while (dirtyRegisters)
   {
+    //Skip to the next changed register
+    while (!(dirtyRegisters & ((uint64_t)1 << reg))) reg++;
 
-    return(_i2cPort->read());
+    //Extend the run as long as the following registers changed too
+    uint8_t runLength = 0;
+    while ((reg + runLength) < SHADOW_SIZE && (dirtyRegisters & ((uint64_t)1 << (reg + runLength))))
+    {
+      dirtyRegisters &= ~((uint64_t)1 << (reg + runLength));
+      runLength++;
+    }
+
+    writeRegisters(reg, &shadow[reg], runLength);
+    reg += runLength;
+  }
+}
+
+//Updates a configuration register: its shadow copy is always kept in sync,
+//the sensor is written either immediately or at the next commitConfig()
+template <class Bus>
+void MAX86150Driver<Bus>::setRegister(uint8_t reg, uint8_t value)
+{
+  shadow[reg] = value;
+
+  if (stagingConfig)
+    dirtyRegisters |= ((uint64_t)1 << reg);
+  else
+    writeRegisters(reg, &shadow[reg], 1);
+}
+
+template <class Bus>
+uint8_t MAX86150Driver<Bus>::readRegister8(uint8_t address, uint8_t reg) {
+  uint8_t value;
+  if (_bus->readRegisters(address, reg, &value, 1))
+  {
+    return (value);
   }
   return (0); //Fail
 }
 
-void MAX86150::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
-  _i2cPort->beginTransmission(address);
-  _i2cPort->write(reg);
-  _i2cPort->write(value);
-  _i2cPort->endTransmission();
-}
\ No newline at end of file
+template <class Bus>
+void MAX86150Driver<Bus>::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
+  _bus->writeRegisters(address, reg, &value, 1);
+
+  // Keep the shadow coherent with writes that bypass setRegister()
+  if (address == _i2caddr && reg < SHADOW_SIZE) shadow[reg] = value;
+}
+
+//Reads `length` contiguous registers, starting at `reg`, in a single transaction
+template <class Bus>
+void MAX86150Driver<Bus>::readRegisters(uint8_t reg, uint8_t *dst, uint8_t length) {
+  _bus->readRegisters(_i2caddr, reg, dst, length);
+}
+
+//Writes `length` contiguous registers, starting at `reg`, in a single transaction (the register address auto-increments)
+template <class Bus>
+void MAX86150Driver<Bus>::writeRegisters(uint8_t reg, const uint8_t *src, uint8_t length) {
+  _bus->writeRegisters(_i2caddr, reg, src, length);
+}
+
+//The driver is compiled once per transport, so that every bus access is a direct call
+#ifdef ARDUINO
+template class MAX86150Driver<WireBus>;
+#endif
+#ifdef I2C_BUS_HAS_IDF
+template class MAX86150Driver<IDFI2CBus>;
+#endif
+#ifdef ESP32
+template class MAX86150Driver<I2CDevice>; //Shares the bus with other tasks through an I2CArbiter
+#endif
+#ifndef ARDUINO
+template class MAX86150Driver<SimulatedMAX86150>; //Host builds only: runs the driver against the simulator
+#endif
+
+#ifdef ARDUINO
+bool MAX86150::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr)
+{
+  wireBus.setPort(&wirePort); //Grab which port the user wants us to use
+  return (MAX86150Driver<WireBus>::begin(wireBus, i2cSpeed, i2caddr));
+}
+#endif
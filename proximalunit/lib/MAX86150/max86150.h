@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include <stdint.h>
+#ifdef ARDUINO
 #if (ARDUINO >= 100)
  #include "Arduino.h"
 #else
@@ -18,6 +20,9 @@
 #endif
 
 #include <Wire.h>
+#endif
+#include <i2c_bus.h>
+#include "max86150_config.h"
 
 #define MAX86150_ADDRESS          0x5E //7-bit I2C Address
 //Note that MAX30102 has the same I2C address and Part ID
@@ -25,40 +30,68 @@
 #define I2C_SPEED_STANDARD        100000
 #define I2C_SPEED_FAST            400000
 
-//Define the size of the I2C buffer based on the platform the user has
-#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-
-  //I2C_BUFFER_LENGTH is defined in Wire.H
-  #define I2C_BUFFER_LENGTH BUFFER_LENGTH
-
-#elif defined(__SAMD21G18A__)
-
-  //SAMD21 uses RingBuffer.h
-  #define I2C_BUFFER_LENGTH SERIAL_BUFFER_SIZE
+#define MAX86150_FIFO_DEPTH       32 //Samples held by the on-chip FIFO
+#define MAX86150_FIFO_MAX_BYTES   (MAX86150_FIFO_DEPTH * 3 * 3) //A full FIFO with 3 active devices, 3 bytes each: 288 bytes
 
-#elif defined(ESP32)
-  #ifndef I2C_BUFFER_LENGTH
-    #define I2C_BUFFER_LENGTH 32
-  #endif
-
-#else
+//Samples buffered on the MCU side between a check() and the moment the user consumes them.
+//Each sample takes 16 bytes, so limit this to fit on your micro. Can be overridden with a build flag.
+#ifndef MAX86150_STORAGE_SIZE
+  #define MAX86150_STORAGE_SIZE   64
+#endif
 
-  //The catch-all default is 32
-  #define I2C_BUFFER_LENGTH 32
+//Circular buffer of readings from the sensor, in structure-of-arrays layout:
+//every channel is contiguous, so whole runs of samples can be handed over with a memcpy.
+//head and tail are free-running counters (count of samples written / consumed), the slot is counter & MASK.
+template <uint16_t DEPTH>
+struct MAX86150SampleRing
+{
+  static_assert((DEPTH & (DEPTH - 1)) == 0, "MAX86150 sample ring depth must be a power of 2");
+  static_assert(DEPTH > MAX86150_FIFO_DEPTH, "MAX86150 sample ring must hold a whole hardware FIFO burst");
+
+  static const uint16_t SIZE = DEPTH;
+  static const uint16_t MASK = DEPTH - 1;
+
+  uint32_t red[DEPTH];
+  uint32_t IR[DEPTH];
+  int32_t ecg[DEPTH];
+  uint32_t timestamp[DEPTH]; //Bus micros() at which the sensor took the sample
+  uint16_t head;
+  uint16_t tail;
+};
 
-#endif
+//Outcome of a non-blocking read (see MAX86150::requestSample()/pollSample())
+enum MAX86150ReadStatus : uint8_t
+{
+  MAX86150_READ_IDLE = 0,  //No read was requested
+  MAX86150_READ_PENDING,   //Still waiting for the sensor: poll again later
+  MAX86150_READ_READY,     //Fresh data: get it with getLatestRed()/getLatestIR()/getLatestECG()
+  MAX86150_READ_TIMEOUT    //No new data within the requested timeout
+};
 
-class MAX86150 {
+//The driver, for a given I2C transport. `Bus` has the same methods as I2CBus (see i2c_bus.h), and is called
+//directly: pass a final class (WireBus, IDFI2CBus, I2CDevice, SimulatedMAX86150) to get no virtual dispatch at all.
+//Time (timeouts, timestamps) is taken from the bus too. The supported transports are instantiated in max86150.cpp,
+//the simulated one on the host only.
+template <class Bus>
+class MAX86150Driver {
  public:
-  MAX86150(void);
+  MAX86150Driver(void);
 
-  boolean begin(TwoWire &wirePort = Wire, uint32_t i2cSpeed = I2C_SPEED_STANDARD, uint8_t i2caddr = MAX86150_ADDRESS);
+  bool begin(Bus &bus, uint32_t i2cSpeed = I2C_SPEED_STANDARD, uint8_t i2caddr = MAX86150_ADDRESS);
 
-  uint32_t getRed(void); //Returns immediate red value
-  uint32_t getIR(void); //Returns immediate IR value
-  int32_t getECG(void); //Returns immediate ECG value
+  uint32_t getRed(void); //Returns immediate red value. Blocks up to 250ms: don't use it from sampling tasks
+  uint32_t getIR(void); //Returns immediate IR value. Blocks up to 250ms: don't use it from sampling tasks
+  int32_t getECG(void); //Returns immediate ECG value. Blocks up to 250ms: don't use it from sampling tasks
   bool safeCheck(uint8_t maxTimeToCheck); //Given a max amount of time, check for new data
 
+  //Non-blocking single-value reads: requestSample() arms a read, then pollSample() is called
+  //at every occasion (e.g. once per task cycle). Each poll does at most one check() and never waits.
+  void requestSample(uint16_t timeoutMs = 250);
+  MAX86150ReadStatus pollSample(void); //READY and TIMEOUT are reported once, then the read goes back to IDLE until the next request
+  uint32_t getLatestRed(void); //Most recent value in the sense array, no I2C traffic
+  uint32_t getLatestIR(void);
+  int32_t getLatestECG(void);
+
   // Configuration
   void softReset();
   void shutDown();
@@ -93,8 +126,11 @@ class MAX86150 {
   void disableALCOVF(void);
   void enablePROXINT(void);
   void disablePROXINT(void);
-  void enableDIETEMPRDY(void);
-  void disableDIETEMPRDY(void);
+
+  //FIFO channel selection: which data each record holds (PPG + ECG, PPG only, ECG only)
+  void setChannels(MAX86150Channels channels);
+  MAX86150Channels getChannels(void);
+  uint16_t getFIFORate(void); //FIFO records per second
 
   //FIFO Configuration (page 18)
   void setFIFOAverage(uint8_t samples);
@@ -104,12 +140,21 @@ class MAX86150 {
 
   //FIFO Reading
   uint16_t check(void); //Checks for new data and fills FIFO
-  uint8_t available(void); //Tells caller how many new samples are available (head - tail)
+  uint16_t available(void); //Tells caller how many new samples are available (head - tail)
   void nextSample(void); //Advances the tail of the sense array
+  uint16_t drain(int32_t *ecg, uint32_t *ir, uint32_t *red, uint16_t maxSamples, uint32_t *timestamps = nullptr); //Moves up to maxSamples pending samples to caller's arrays, oldest first. Pass nullptr for channels not in the FIFO
   uint32_t getFIFORed(void); //Returns the FIFO sample pointed to by tail
   uint32_t getFIFOIR(void); //Returns the FIFO sample pointed to by tail
   int32_t getFIFOECG(void); //Returns the FIFO sample pointed to by tail
 
+  uint32_t getFIFOTimestamp(void); //Returns the timestamp [us] of the FIFO sample pointed to by tail
+
+  //Lost samples, counted since construction or the last resetDropCounters()
+  uint32_t getFIFOOverflows(void); //Overwritten in the sensor's FIFO because check() came too late (OVF_COUNTER)
+  uint32_t getRingOverflows(void); //Overwritten in the sense array because the user didn't consume them in time
+  uint32_t getDroppedSamples(void); //Sum of the two above
+  void resetDropCounters(void);
+
   uint8_t getWritePointer(void);
   uint8_t getReadPointer(void);
   void clearFIFO(void); //Sets the read/write pointers to zero
@@ -117,45 +162,83 @@ class MAX86150 {
   //Proximity Mode Interrupt Threshold
   void setPROXINTTHRESH(uint8_t val);
 
-  // Die Temperature
-  float readTemperature();
-  float readTemperatureF();
-
   // Detecting ID/Revision
   uint8_t getRevisionID();
   uint8_t readPartID();
 	uint8_t readRegLED();
 
-  // Setup the IC with user selectable settings
-  void setup(byte powerLevel = 0x1F, byte sampleAverage = 4, byte ledMode = 3, int sampleRate = 400, int pulseWidth = 411, int adcRange = 4096);
+  // Batched configuration: between beginConfig() and commitConfig(), setters only touch the register shadow,
+  // then every changed register is flushed at once, in as few burst writes as possible
+  void beginConfig(void);
+  void commitConfig(void);
+
+  // Setup the IC with user selectable settings (sampleRate [sps], pulseWidth [us], adcRange [nA]). Returns false if not supported.
+  bool setup(uint8_t powerLevel = 0xFF, uint8_t sampleAverage = 2, uint8_t ledMode = 3, int sampleRate = 200, int pulseWidth = 100, int adcRange = 32768);
+  // Setup the IC with precomputed register values, e.g. `setup(MAX86150Config<400, 400>::registers)`
+  void setup(const MAX86150Registers &config);
 
   // Low-level I2C communication
   uint8_t readRegister8(uint8_t address, uint8_t reg);
   void writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
 
  private:
-  TwoWire *_i2cPort; //The generic connection to user's chosen I2C hardware
+  Bus *_bus; //The generic connection to user's chosen I2C hardware
   int _i2caddr;
 
   //activeLEDs is the number of channels turned on, and can be 1 to 3. 2 is common for Red+IR.
-  byte activeDevices; //Gets set during setup. Allows check() to calculate how many bytes to read from FIFO
+  uint8_t activeDevices; //Gets set during setup. Allows check() to calculate how many bytes to read from FIFO
+  MAX86150Channels channels = MAX86150_CHANNELS_PPG_ECG; //Layout of each FIFO record. Allows check() to unpack it
+  uint16_t ecgRate = 0; //[sps]
+  uint16_t ppgRate = 0; //[sps], after averaging
+  uint32_t samplePeriod = 0; //[us] between two FIFO records, used to timestamp them
+
+  //Drop accounting
+  uint32_t fifoOverflows = 0;
+  uint32_t ringOverflows = 0;
 
   uint8_t revisionID;
 
+  //Non-blocking read state
+  MAX86150ReadStatus readStatus = MAX86150_READ_IDLE;
+  uint32_t readRequestTime = 0; //Bus micros() of the last requestSample()
+  uint16_t readTimeout = 0; //[ms]
+
   void readRevisionID();
 
   void bitMask(uint8_t reg, uint8_t mask, uint8_t thing);
 
-  #define STORAGE_SIZE 6 //Each long is 4 bytes so limit this to fit on your micro
-  typedef struct Record
-  {
-    uint32_t red[STORAGE_SIZE];
-    uint32_t IR[STORAGE_SIZE];
-    int32_t ecg[STORAGE_SIZE];
-    byte head;
-    byte tail;
-  } sense_struct; //This is our circular buffer of readings from the sensor
+  //Register shadow: mirror of the configuration registers (0x00-0x3F), so that masked updates need no read-back
+  static constexpr uint8_t SHADOW_SIZE = 0x40;
+  uint8_t shadow[SHADOW_SIZE] = {0};
+  uint64_t dirtyRegisters = 0; //Bit n set --> register n changed since beginConfig()
+  static_assert(SHADOW_SIZE <= 64, "MAX86150: dirtyRegisters has one bit per shadow register");
+  bool stagingConfig = false;
+
+  void loadShadow(void);
+  void setRegister(uint8_t reg, uint8_t value);
+  void readRegisters(uint8_t reg, uint8_t *dst, uint8_t length);
+  void writeRegisters(uint8_t reg, const uint8_t *src, uint8_t length);
+
+  //FIFO burst reading
+  void readFIFOBurst(uint8_t *dst, int length); //Reads `length` bytes of FIFO_DATA into one contiguous buffer
+  void unpackFIFO(const uint8_t *src, int numberOfSamples, uint32_t lastTimestamp); //Converts a burst of raw FIFO records into the sense array
+
+  uint8_t fifoBuffer[MAX86150_FIFO_MAX_BYTES]; //Raw bytes of the last FIFO burst
+
+  typedef MAX86150SampleRing<MAX86150_STORAGE_SIZE> sense_struct; //This is our circular buffer of readings from the sensor
 
   sense_struct sense;
 
 };
+
+#ifdef ARDUINO
+//The driver on the Arduino Wire library, which is what most sketches want
+class MAX86150 : public MAX86150Driver<WireBus> {
+ public:
+  using MAX86150Driver<WireBus>::begin;
+  bool begin(TwoWire &wirePort = Wire, uint32_t i2cSpeed = I2C_SPEED_STANDARD, uint8_t i2caddr = MAX86150_ADDRESS);
+
+ private:
+  WireBus wireBus; //Adapter around the TwoWire port given to begin()
+};
+#endif
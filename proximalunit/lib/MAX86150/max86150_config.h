@@ -0,0 +1,272 @@
+/***************************************************
+  Compile-time configuration for the MAX86150 driver.
+
+  MAX86150Config<...> turns human units (samples/s, us, nA, V/V) into the raw values of the
+  FIFO, PPG, LED and ECG configuration registers, at compile time.
+  Combinations the sensor can't do are rejected with a static_assert.
+
+  Register maps are from the MAX86150 datasheet (rev. 1), pages 30-35.
+ *****************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+//Which channels the sensor stores in its FIFO. Every channel costs 3 bytes per record over I2C
+enum MAX86150Channels : uint8_t
+{
+  MAX86150_CHANNELS_PPG_ECG = 0, //FD1 = IR (LED1), FD2 = Red (LED2), FD3 = ECG: 9 bytes per record
+  MAX86150_CHANNELS_PPG = 1,     //FD1 = IR (LED1), FD2 = Red (LED2): 6 bytes per record
+  MAX86150_CHANNELS_ECG = 2      //FD1 = ECG: 3 bytes per record
+};
+
+//Raw register values of a complete sensor configuration, as written by MAX86150::setup(const MAX86150Registers&)
+struct MAX86150Registers
+{
+  uint8_t fifoConfig;     //0x08 FIFO Configuration
+  uint8_t fifoControl1;   //0x09 FIFO Data Control 1 (FD2|FD1)
+  uint8_t fifoControl2;   //0x0A FIFO Data Control 2 (FD4|FD3)
+  uint8_t ppgConfig1;     //0x0E PPG Configuration 1
+  uint8_t ppgConfig2;     //0x0F PPG Configuration 2
+  uint8_t led1Amplitude;  //0x11 LED1 (IR) Pulse Amplitude
+  uint8_t led2Amplitude;  //0x12 LED2 (Red) Pulse Amplitude
+  uint8_t ledRange;       //0x14 LED Range
+  uint8_t ecgConfig1;     //0x3C ECG Configuration 1
+  uint8_t ecgConfig3;     //0x3E ECG Configuration 3
+  uint8_t activeDevices;  //Data slots per FIFO record (3 bytes each)
+  uint16_t fifoRate;      //FIFO records per second
+  MAX86150Channels channels;
+  uint16_t ecgRate;       //ECG samples per second
+  uint16_t ppgRate;       //PPG samples per second, after averaging
+};
+
+namespace max86150cfg
+{
+  //Every *Code() function returns -1 for values the sensor doesn't support
+
+  //ECG_CONFIG1 [2:0] = ECG_ADC_CLK | ECG_ADC_OSR[1:0]
+  constexpr int ecgRateCode(uint16_t sps)
+  {
+    switch (sps)
+    {
+      case 200:  return 0b011;
+      case 400:  return 0b010;
+      case 800:  return 0b001;
+      case 1600: return 0b000;
+      case 3200: return 0b100;
+      default:   return -1;
+    }
+  }
+
+  //PPG_CONFIG1 [5:2] = PPG_SR (1 pulse per sample)
+  constexpr int ppgRateCode(uint16_t sps)
+  {
+    switch (sps)
+    {
+      case 10:   return 0x0;
+      case 20:   return 0x1;
+      case 50:   return 0x2;
+      case 84:   return 0x3;
+      case 100:  return 0x4;
+      case 200:  return 0x5;
+      case 400:  return 0x6;
+      case 800:  return 0x7;
+      case 1000: return 0x8;
+      case 1600: return 0x9;
+      case 3200: return 0xA;
+      default:   return -1;
+    }
+  }
+
+  //PPG_CONFIG1 [1:0] = PPG_LED_PW
+  constexpr int pulseWidthCode(uint16_t us)
+  {
+    switch (us)
+    {
+      case 50:  return 0b00;
+      case 100: return 0b01;
+      case 200: return 0b10;
+      case 400: return 0b11;
+      default:  return -1;
+    }
+  }
+
+  //Longest LED pulse that fits in a sample period at the given PPG rate
+  constexpr uint16_t maxPulseWidth(uint16_t sps)
+  {
+    return (sps <= 200) ? 400 : (sps <= 400) ? 200 : (sps <= 1000) ? 100 : 50;
+  }
+
+  //PPG_CONFIG1 [7:6] = PPG_ADC_RGE (full scale, in nA)
+  constexpr int adcRangeCode(uint16_t nA)
+  {
+    switch (nA)
+    {
+      case 4096:  return 0b00;
+      case 8192:  return 0b01;
+      case 16384: return 0b10;
+      case 32768: return 0b11;
+      default:    return -1;
+    }
+  }
+
+  //PPG_CONFIG2 [2:0] = SMP_AVE
+  constexpr int averageCode(uint8_t samples)
+  {
+    switch (samples)
+    {
+      case 1:  return 0b000;
+      case 2:  return 0b001;
+      case 4:  return 0b010;
+      case 8:  return 0b011;
+      case 16: return 0b100;
+      case 32: return 0b101;
+      default: return -1;
+    }
+  }
+
+  //ECG_CONFIG3 [3:2] = PGA_ECG_GAIN (V/V)
+  constexpr int pgaGainCode(uint8_t gain)
+  {
+    switch (gain)
+    {
+      case 1: return 0b00;
+      case 2: return 0b01;
+      case 4: return 0b10;
+      case 8: return 0b11;
+      default: return -1;
+    }
+  }
+
+  //ECG_CONFIG3 [1:0] = IA_GAIN, expressed in tenths of V/V (9.5 V/V --> 95)
+  constexpr int iaGainCode(uint16_t gainX10)
+  {
+    switch (gainX10)
+    {
+      case 50:  return 0b00;
+      case 95:  return 0b01;
+      case 200: return 0b10;
+      case 500: return 0b11;
+      default:  return -1;
+    }
+  }
+
+  //FIFO_CONTROL1 = FD2 | FD1, FIFO_CONTROL2 = FD4 | FD3
+  //FDx options: 0001 -> PPG LED1 (IR), 0010 -> PPG LED2 (Red), 1001 -> ECG
+  constexpr uint8_t fifoControl1(MAX86150Channels channels)
+  {
+    return (channels == MAX86150_CHANNELS_ECG) ? 0b00001001 : 0b00100001;
+  }
+
+  constexpr uint8_t fifoControl2(MAX86150Channels channels)
+  {
+    return (channels == MAX86150_CHANNELS_PPG_ECG) ? 0b00001001 : 0b00000000;
+  }
+
+  constexpr uint8_t activeDevices(MAX86150Channels channels)
+  {
+    return (channels == MAX86150_CHANNELS_PPG_ECG) ? 3 : (channels == MAX86150_CHANNELS_PPG) ? 2 : 1;
+  }
+
+  //Records per second entering the FIFO: the ECG ADC paces them whenever it's enabled
+  constexpr uint16_t fifoRate(MAX86150Channels channels, uint16_t ecgRate, uint16_t ppgRate)
+  {
+    return (channels == MAX86150_CHANNELS_PPG) ? ppgRate : ecgRate;
+  }
+
+  //LED_RANGE [3:0] = LED2_RGE | LED1_RGE, max current in mA
+  constexpr int ledRangeCode(uint8_t mA)
+  {
+    return (mA == 50) ? 0x00 : (mA == 100) ? 0x05 : -1;
+  }
+
+  //Human-readable description of a configuration: the same fields the template takes
+  struct Settings
+  {
+    uint16_t ecgRate;       //[sps]
+    uint16_t ppgRate;       //[sps], before averaging
+    uint8_t ppgAverage;     //PPG samples averaged per FIFO record
+    uint16_t pulseWidth;    //[us]
+    uint16_t adcRange;      //[nA]
+    uint8_t pgaGain;        //[V/V]
+    uint16_t iaGainX10;     //[V/V * 10]
+    uint8_t ledAmplitude;   //0x00 = 0mA ... 0xFF = full LED range
+    uint8_t ledRange;       //[mA]
+    uint8_t almostFullFree; //A_FULL fires when this many FIFO slots (out of 32) are left free
+    MAX86150Channels channels;
+  };
+
+  constexpr bool isValid(const Settings &s)
+  {
+    return ecgRateCode(s.ecgRate) >= 0 && ppgRateCode(s.ppgRate) >= 0 && pulseWidthCode(s.pulseWidth) >= 0
+        && s.pulseWidth <= maxPulseWidth(s.ppgRate) && adcRangeCode(s.adcRange) >= 0 && averageCode(s.ppgAverage) >= 0
+        && pgaGainCode(s.pgaGain) >= 0 && iaGainCode(s.iaGainX10) >= 0 && ledRangeCode(s.ledRange) >= 0
+        && (s.channels != MAX86150_CHANNELS_PPG_ECG || s.ecgRate == s.ppgRate) && s.almostFullFree <= 0x0F;
+  }
+
+  //Register values for `s`, which must be valid (see isValid())
+  constexpr MAX86150Registers build(const Settings &s)
+  {
+    return MAX86150Registers {
+      /* FIFO Configuration: A_FULL_TYPE = 1 (assert once per A_FULL condition),
+       * FIFO_ROLLS_ON_FULL = 1, FIFO_A_FULL = free slots at which the interrupt fires */
+      (uint8_t)(0x40 | 0x10 | (s.almostFullFree & 0x0F)),
+      fifoControl1(s.channels),
+      fifoControl2(s.channels),
+      (uint8_t)((adcRangeCode(s.adcRange) << 6) | (ppgRateCode(s.ppgRate) << 2) | pulseWidthCode(s.pulseWidth)),
+      (uint8_t)averageCode(s.ppgAverage),
+      s.ledAmplitude,
+      s.ledAmplitude,
+      (uint8_t)ledRangeCode(s.ledRange),
+      (uint8_t)ecgRateCode(s.ecgRate),
+      (uint8_t)((pgaGainCode(s.pgaGain) << 2) | iaGainCode(s.iaGainX10)),
+      activeDevices(s.channels),
+      fifoRate(s.channels, s.ecgRate, s.ppgRate / s.ppgAverage),
+      s.channels,
+      s.ecgRate,
+      (uint16_t)(s.ppgRate / s.ppgAverage)
+    };
+  }
+}
+
+/* Compile-time configuration of the sensor.
+ * Pass `MAX86150Config<...>::registers` to MAX86150::setup(); the defaults reproduce the firmware's historical setup:
+ * ECG and PPG at 200 sps, PPG averaging 2, 100us pulses, 32768nA ADC range, ECG gain 9.5 * 8 V/V, LEDs at 50mA.
+ *
+ * When both are stored in the FIFO, PPG and ECG share the record cadence, so both ADCs must be set to the same rate.
+ * ECG-only moves 3 bytes per sample instead of 9: that's what makes 800-1600 sps ECG fit on a 400 kHz bus.
+*/
+template <uint16_t EcgRate = 200, uint16_t PpgRate = 200, uint8_t PpgAverage = 2, uint16_t PulseWidthUs = 100,
+          uint16_t AdcRangeNa = 32768, uint8_t PgaGain = 8, uint16_t IaGainX10 = 95, uint8_t LedAmplitude = 0xFF,
+          uint8_t LedRangeMa = 50, uint8_t AlmostFullFree = 15, MAX86150Channels Channels = MAX86150_CHANNELS_PPG_ECG>
+struct MAX86150Config
+{
+  static_assert(max86150cfg::ecgRateCode(EcgRate) >= 0, "MAX86150: ECG rate must be one of 200, 400, 800, 1600, 3200 sps");
+  static_assert(max86150cfg::ppgRateCode(PpgRate) >= 0, "MAX86150: PPG rate must be one of 10, 20, 50, 84, 100, 200, 400, 800, 1000, 1600, 3200 sps");
+  static_assert(Channels != MAX86150_CHANNELS_PPG_ECG || EcgRate == PpgRate, "MAX86150: ECG and PPG rates must match, as they share the FIFO record cadence");
+  static_assert(max86150cfg::averageCode(PpgAverage) >= 0, "MAX86150: PPG averaging must be 1, 2, 4, 8, 16 or 32 samples");
+  static_assert(max86150cfg::pulseWidthCode(PulseWidthUs) >= 0, "MAX86150: LED pulse width must be 50, 100, 200 or 400 us");
+  static_assert(PulseWidthUs <= max86150cfg::maxPulseWidth(PpgRate), "MAX86150: LED pulse width too long for this PPG rate");
+  static_assert(max86150cfg::adcRangeCode(AdcRangeNa) >= 0, "MAX86150: PPG ADC range must be 4096, 8192, 16384 or 32768 nA");
+  static_assert(max86150cfg::pgaGainCode(PgaGain) >= 0, "MAX86150: ECG PGA gain must be 1, 2, 4 or 8 V/V");
+  static_assert(max86150cfg::iaGainCode(IaGainX10) >= 0, "MAX86150: ECG IA gain must be 5, 9.5, 20 or 50 V/V (given x10)");
+  static_assert(max86150cfg::ledRangeCode(LedRangeMa) >= 0, "MAX86150: LED range must be 50 or 100 mA");
+  static_assert(AlmostFullFree <= 0x0F, "MAX86150: A_FULL can leave at most 15 free FIFO slots");
+
+  static constexpr max86150cfg::Settings settings = {
+    EcgRate, PpgRate, PpgAverage, PulseWidthUs, AdcRangeNa, PgaGain, IaGainX10, LedAmplitude, LedRangeMa, AlmostFullFree, Channels
+  };
+  static constexpr MAX86150Registers registers = max86150cfg::build(settings);
+};
+
+//Sanity checks: the default configuration matches the register values the firmware used to hand-write in setup()
+static_assert(MAX86150Config<>::registers.fifoConfig == 0x5F, "MAX86150Config: FIFO Configuration");
+static_assert(MAX86150Config<>::registers.ppgConfig1 == 0b11010101, "MAX86150Config: PPG Configuration 1");
+static_assert(MAX86150Config<>::registers.ppgConfig2 == 0b00000001, "MAX86150Config: PPG Configuration 2");
+static_assert(MAX86150Config<>::registers.ecgConfig1 == 0b00000011, "MAX86150Config: ECG Configuration 1");
+static_assert(MAX86150Config<>::registers.ecgConfig3 == 0b00001101, "MAX86150Config: ECG Configuration 3");
+static_assert(MAX86150Config<1600, 1600, 1, 50>::registers.ecgConfig1 == 0b00000000, "MAX86150Config: 1600 sps ECG");
+static_assert(MAX86150Config<800, 800, 1, 100>::registers.ppgConfig1 == 0b11011101, "MAX86150Config: 800 sps PPG");
+static_assert(MAX86150Config<>::registers.fifoControl1 == 0b00100001 && MAX86150Config<>::registers.fifoControl2 == 0b00001001, "MAX86150Config: PPG+ECG slots");
+static_assert(MAX86150Config<1600, 100, 1, 100, 32768, 8, 95, 0xFF, 50, 15, MAX86150_CHANNELS_ECG>::registers.fifoControl1 == 0b00001001, "MAX86150Config: ECG-only slots");
+static_assert(MAX86150Config<1600, 100, 1, 100, 32768, 8, 95, 0xFF, 50, 15, MAX86150_CHANNELS_ECG>::registers.fifoRate == 1600, "MAX86150Config: ECG-only rate");
@@ -0,0 +1,428 @@
+/***************************************************
+  Register-level simulator of the MAX86150 (see max86150_sim.h)
+ *****************************************************/
+
+#ifndef ARDUINO //The simulator is a host-side tool: keep it out of the firmware
+
+#include "max86150_sim.h"
+
+#include <math.h>
+#include <string.h>
+
+//Registers the simulator gives a meaning to
+static const uint8_t REG_INTSTAT1 = 0x00;
+static const uint8_t REG_INTSTAT2 = 0x01;
+static const uint8_t REG_INTENABLE1 = 0x02;
+static const uint8_t REG_INTENABLE2 = 0x03;
+static const uint8_t REG_FIFOWRITEPTR = 0x04;
+static const uint8_t REG_FIFOOVERFLOW = 0x05;
+static const uint8_t REG_FIFOREADPTR = 0x06;
+static const uint8_t REG_FIFODATA = 0x07;
+static const uint8_t REG_FIFOCONFIG = 0x08;
+static const uint8_t REG_FIFOCONTROL1 = 0x09;
+static const uint8_t REG_FIFOCONTROL2 = 0x0A;
+static const uint8_t REG_SYSCONTROL = 0x0D;
+static const uint8_t REG_PPGCONFIG1 = 0x0E;
+static const uint8_t REG_PPGCONFIG2 = 0x0F;
+static const uint8_t REG_LED1_PULSEAMP = 0x11;
+static const uint8_t REG_LED2_PULSEAMP = 0x12;
+static const uint8_t REG_ECG_CONFIG1 = 0x3C;
+static const uint8_t REG_PARTID = 0xFF;
+
+//Interrupt status/enable bits
+static const uint8_t INT_A_FULL = 0x80;
+static const uint8_t INT_PPG_RDY = 0x40;
+static const uint8_t INT_PWR_RDY = 0x01;
+static const uint8_t INT_ECG_RDY = 0x04;
+
+//FIFO_CONFIG bits
+static const uint8_t FIFO_A_FULL_TYPE = 0x40;
+static const uint8_t FIFO_STAT_CLR = 0x20;
+static const uint8_t FIFO_ROLLS_ON_FULL = 0x10;
+
+//SYSTEM_CONTROL bits
+static const uint8_t SYS_FIFO_EN = 0x04;
+static const uint8_t SYS_SHDN = 0x02;
+static const uint8_t SYS_RESET = 0x01;
+
+//FDx slot codes
+static const uint8_t SLOT_LED1 = 0x1;
+static const uint8_t SLOT_LED2 = 0x2;
+static const uint8_t SLOT_ECG = 0x9;
+
+static const uint8_t FIFO_DEPTH = 32;
+static const uint8_t EXPECTED_PARTID = 0x1E;
+
+static const double HEART_RATE = 72.0 / 60.0; //[Hz] of the default waveforms
+
+SimulatedMAX86150::SimulatedMAX86150(uint8_t address) : _address(address)
+{
+  for (uint8_t s = 0; s < 3; s++) setWaveform((MAX86150SimSignal)s, nullptr);
+  reset();
+  resetStats();
+}
+
+//
+// I2CBus
+//
+
+void SimulatedMAX86150::begin(uint32_t clockHz)
+{
+  _clockHz = clockHz;
+}
+
+uint16_t SimulatedMAX86150::maxReadLength(void)
+{
+  return (_maxReadLength);
+}
+
+bool SimulatedMAX86150::writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length)
+{
+  //START | address + W | register | data... | STOP
+  if (address != _address)
+  {
+    chargeBus(1 + 9 + 1, 0); //NACK after the address
+    return false;
+  }
+
+  for (uint16_t i = 0; i < length; i++) writeRegister(reg++, src[i]);
+
+  chargeBus(1 + (2 + length) * 9 + 1, 1 + length);
+  return true;
+}
+
+bool SimulatedMAX86150::readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length)
+{
+  //START | address + W | register | Sr | address + R | data... | STOP
+  if (address != _address)
+  {
+    chargeBus(1 + 9 + 1, 0);
+    return false;
+  }
+  if (length > _maxReadLength) length = _maxReadLength; //The host's buffer can't take more
+
+  for (uint16_t i = 0; i < length; i++)
+  {
+    dst[i] = readRegister(reg);
+    if (reg != REG_FIFODATA) reg++; //FIFO_DATA doesn't auto-increment
+  }
+
+  chargeBus(1 + 2 * 9 + 1 + (1 + length) * 9 + 1, 1 + length);
+  return true;
+}
+
+//Every transaction keeps the bus busy for its bit count at the SCL rate, plus the fixed software overhead
+void SimulatedMAX86150::chargeBus(uint32_t bits, uint16_t bytes)
+{
+  const uint32_t us = (uint32_t)(((uint64_t)bits * 1000000UL + _clockHz - 1) / _clockHz) + _transactionOverhead;
+
+  _stats.transactions++;
+  _stats.bytes += bytes;
+  _stats.busTime += us;
+  advance(us);
+}
+
+//
+// Time
+//
+
+void SimulatedMAX86150::advance(uint32_t us)
+{
+  advanceTo(_now + us);
+}
+
+void SimulatedMAX86150::advanceTo(uint64_t t)
+{
+  while (_running && _nextSample <= (double)t)
+  {
+    //Schedule the next record first: produceRecord() may call the interrupt handler, which may talk to us
+    _now = (uint64_t)_nextSample;
+    _nextSample += 1000000.0 / getRecordRate();
+    produceRecord();
+  }
+  if (t > _now) _now = t;
+}
+
+//Records per second entering the FIFO: the ECG ADC paces them whenever it's in a slot, the PPG one otherwise
+uint32_t SimulatedMAX86150::getRecordRate(void)
+{
+  const uint8_t sys = _regs[REG_SYSCONTROL];
+  if (!(sys & SYS_FIFO_EN) || (sys & SYS_SHDN)) return 0;
+
+  bool hasECG = false, hasPPG = false;
+  const uint8_t slots[4] = {(uint8_t)(_regs[REG_FIFOCONTROL1] & 0x0F), (uint8_t)(_regs[REG_FIFOCONTROL1] >> 4),
+                            (uint8_t)(_regs[REG_FIFOCONTROL2] & 0x0F), (uint8_t)(_regs[REG_FIFOCONTROL2] >> 4)};
+  for (uint8_t i = 0; i < 4 && slots[i]; i++)
+  {
+    hasECG |= (slots[i] == SLOT_ECG);
+    hasPPG |= (slots[i] == SLOT_LED1 || slots[i] == SLOT_LED2);
+  }
+
+  if (hasECG)
+  {
+    //ECG_CONFIG1 [2:0] = ECG_ADC_CLK | ECG_ADC_OSR[1:0]
+    static const uint16_t ecgRates[8] = {1600, 800, 400, 200, 3200, 1600, 800, 400};
+    return (ecgRates[_regs[REG_ECG_CONFIG1] & 0x07]);
+  }
+  if (hasPPG)
+  {
+    //PPG_CONFIG1 [5:2] = PPG_SR, PPG_CONFIG2 [2:0] = SMP_AVE
+    static const uint16_t ppgRates[16] = {10, 20, 50, 84, 100, 200, 400, 800, 1000, 1600, 3200, 10, 20, 50, 84, 100};
+    uint8_t average = _regs[REG_PPGCONFIG2] & 0x07;
+    if (average > 5) average = 5;
+    const uint32_t rate = ppgRates[(_regs[REG_PPGCONFIG1] >> 2) & 0x0F] >> average;
+    return (rate ? rate : 1);
+  }
+  return 0;
+}
+
+//Starts/stops the sample clock when the configuration changes
+void SimulatedMAX86150::updateRunning(void)
+{
+  const uint32_t rate = getRecordRate();
+  _running = (rate > 0);
+  if (_running) _nextSample = (double)_now + 1000000.0 / rate;
+}
+
+//
+// Front-end and FIFO
+//
+
+void SimulatedMAX86150::produceRecord(void)
+{
+  const uint8_t slots[4] = {(uint8_t)(_regs[REG_FIFOCONTROL1] & 0x0F), (uint8_t)(_regs[REG_FIFOCONTROL1] >> 4),
+                            (uint8_t)(_regs[REG_FIFOCONTROL2] & 0x0F), (uint8_t)(_regs[REG_FIFOCONTROL2] >> 4)};
+  uint8_t &writePointer = _regs[REG_FIFOWRITEPTR];
+  uint8_t &readPointer = _regs[REG_FIFOREADPTR];
+  uint8_t &overflow = _regs[REG_FIFOOVERFLOW];
+
+  if (_fifoCount == FIFO_DEPTH)
+  {
+    if (overflow < 0x1F) overflow++;
+    _stats.samplesLost++;
+    if (!(_regs[REG_FIFOCONFIG] & FIFO_ROLLS_ON_FULL)) return; //The new record is discarded
+
+    //Roll over: the oldest record is overwritten
+    readPointer = (readPointer + 1) & 0x1F;
+    _fifoCount--;
+    _byteInRecord = 0;
+  }
+
+  //Slots are filled in order, the first disabled one ends the record
+  uint8_t *record = _fifo[writePointer];
+  uint8_t size = 0;
+  bool hasECG = false, hasPPG = false;
+  for (uint8_t i = 0; i < 4 && slots[i]; i++, size += 3)
+  {
+    uint32_t datum = 0;
+    if (slots[i] == SLOT_LED1 || slots[i] == SLOT_LED2)
+    {
+      const double v = sampleSignal(slots[i] == SLOT_LED1 ? MAX86150_SIM_IR : MAX86150_SIM_RED);
+      datum = (v <= 0) ? 0 : (v >= 0x7FFFF) ? 0x7FFFF : (uint32_t)v;
+      hasPPG = true;
+    }
+    else if (slots[i] == SLOT_ECG)
+    {
+      const double v = sampleSignal(MAX86150_SIM_ECG);
+      const int32_t clipped = (v <= -131072) ? -131072 : (v >= 131071) ? 131071 : (int32_t)v;
+      datum = (uint32_t)clipped & 0x3FFFF;
+      hasECG = true;
+    }
+    record[size] = datum >> 16;
+    record[size + 1] = datum >> 8;
+    record[size + 2] = datum;
+  }
+  _recordSize[writePointer] = size;
+  if (size == 0) return; //No slot enabled: nothing is stored
+
+  writePointer = (writePointer + 1) & 0x1F;
+  _fifoCount++;
+  _stats.samplesProduced++;
+
+  //Interrupt flags
+  if (hasPPG) _regs[REG_INTSTAT1] |= INT_PPG_RDY;
+  if (hasECG) _regs[REG_INTSTAT2] |= INT_ECG_RDY;
+  const uint8_t almostFull = FIFO_DEPTH - (_regs[REG_FIFOCONFIG] & 0x0F);
+  if (_fifoCount >= almostFull)
+  {
+    //A_FULL_TYPE = 1: assert only when the threshold is crossed, 0: on every record above it
+    if (!(_regs[REG_FIFOCONFIG] & FIFO_A_FULL_TYPE) || _fifoCount == almostFull) _regs[REG_INTSTAT1] |= INT_A_FULL;
+  }
+  updateInterruptLine();
+}
+
+double SimulatedMAX86150::sampleSignal(MAX86150SimSignal signal)
+{
+  double v = _waveforms[signal]((double)_now / 1000000.0);
+  //The photodiode current scales with the LED current
+  if (signal == MAX86150_SIM_IR) v *= _regs[REG_LED1_PULSEAMP] / 255.0;
+  if (signal == MAX86150_SIM_RED) v *= _regs[REG_LED2_PULSEAMP] / 255.0;
+  return (v);
+}
+
+uint8_t SimulatedMAX86150::readFIFOByte(void)
+{
+  if (_fifoCount == 0) return 0; //Reading an empty FIFO doesn't move the pointers
+
+  uint8_t &readPointer = _regs[REG_FIFOREADPTR];
+  const uint8_t value = _fifo[readPointer][_byteInRecord++];
+
+  if (_byteInRecord >= _recordSize[readPointer])
+  {
+    //A whole record was popped
+    readPointer = (readPointer + 1) & 0x1F;
+    _fifoCount--;
+    _byteInRecord = 0;
+    _regs[REG_FIFOOVERFLOW] = 0;
+  }
+  if (_regs[REG_FIFOCONFIG] & FIFO_STAT_CLR)
+  {
+    _regs[REG_INTSTAT1] &= ~(INT_A_FULL | INT_PPG_RDY);
+    _regs[REG_INTSTAT2] &= ~INT_ECG_RDY;
+    updateInterruptLine();
+  }
+  return (value);
+}
+
+//
+// Registers
+//
+
+void SimulatedMAX86150::reset(void)
+{
+  memset(_regs, 0, sizeof(_regs));
+  _regs[REG_INTSTAT1] = INT_PWR_RDY;
+  _regs[REG_PARTID] = EXPECTED_PARTID;
+  _fifoCount = 0;
+  _byteInRecord = 0;
+  _running = false;
+  updateInterruptLine();
+}
+
+void SimulatedMAX86150::writeRegister(uint8_t reg, uint8_t value)
+{
+  switch (reg)
+  {
+    case REG_INTSTAT1:
+    case REG_INTSTAT2:
+    case REG_FIFODATA:
+    case REG_PARTID:
+      return; //Read-only
+
+    case REG_SYSCONTROL:
+      if (value & SYS_RESET)
+      {
+        reset(); //The reset bit clears itself once done
+        return;
+      }
+      _regs[reg] = value;
+      updateRunning();
+      return;
+
+    case REG_FIFOWRITEPTR:
+    case REG_FIFOREADPTR:
+      _regs[reg] = value & 0x1F;
+      _fifoCount = (_regs[REG_FIFOWRITEPTR] - _regs[REG_FIFOREADPTR]) & 0x1F;
+      _byteInRecord = 0;
+      return;
+
+    case REG_FIFOOVERFLOW:
+      _regs[reg] = value & 0x1F;
+      return;
+
+    case REG_INTENABLE1:
+    case REG_INTENABLE2:
+      _regs[reg] = value;
+      updateInterruptLine();
+      return;
+
+    case REG_FIFOCONTROL1:
+    case REG_FIFOCONTROL2:
+    case REG_PPGCONFIG1:
+    case REG_PPGCONFIG2:
+    case REG_ECG_CONFIG1:
+      _regs[reg] = value;
+      updateRunning();
+      return;
+
+    default:
+      _regs[reg] = value;
+      return;
+  }
+}
+
+uint8_t SimulatedMAX86150::readRegister(uint8_t reg)
+{
+  uint8_t value;
+  switch (reg)
+  {
+    case REG_FIFODATA:
+      return (readFIFOByte());
+
+    case REG_INTSTAT1:
+    case REG_INTSTAT2:
+      //Interrupt flags are cleared by reading them
+      value = _regs[reg];
+      _regs[reg] = 0;
+      updateInterruptLine();
+      return (value);
+
+    default:
+      return (_regs[reg]);
+  }
+}
+
+//
+// Interrupt line
+//
+
+//An enabled interrupt flag is set: the INT pin is pulled low
+bool SimulatedMAX86150::isInterruptPending(void)
+{
+  return ((_regs[REG_INTSTAT1] & _regs[REG_INTENABLE1] & 0xF0) || (_regs[REG_INTSTAT2] & _regs[REG_INTENABLE2] & 0x84));
+}
+
+void SimulatedMAX86150::updateInterruptLine(void)
+{
+  if (isInterruptPending()) _intLine.fire(); //The line only calls its handler on the falling edge
+  else _intLine.release();
+}
+
+//
+// Settings and statistics
+//
+
+void SimulatedMAX86150::setWaveform(MAX86150SimSignal signal, MAX86150SimWaveform waveform)
+{
+  static const MAX86150SimWaveform defaults[3] = {defaultIR, defaultRed, defaultECG};
+  _waveforms[signal] = waveform ? waveform : defaults[signal];
+}
+
+void SimulatedMAX86150::resetStats(void)
+{
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+//
+// Default waveforms
+//
+
+double SimulatedMAX86150::defaultECG(double t)
+{
+  const double phase = fmod(t * HEART_RATE, 1.0); //Fraction of the current beat
+  const double r = (phase - 0.30) / 0.012;
+  const double tw = (phase - 0.55) / 0.05;
+  return (20000.0 * exp(-r * r) + 3000.0 * exp(-tw * tw));
+}
+
+double SimulatedMAX86150::defaultIR(double t)
+{
+  return (150000.0 + 6000.0 * sin(2.0 * M_PI * HEART_RATE * t));
+}
+
+double SimulatedMAX86150::defaultRed(double t)
+{
+  return (120000.0 + 4000.0 * sin(2.0 * M_PI * HEART_RATE * t - 0.3));
+}
+
+#endif
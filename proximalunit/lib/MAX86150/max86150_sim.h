@@ -0,0 +1,122 @@
+/***************************************************
+  Register-level simulator of the MAX86150, seen through the I2CBus interface.
+
+  It models what the driver relies on: the register file and soft reset, the 32-record FIFO with its
+  write/read pointers, OVF_COUNTER and roll-over, the A_FULL / PPG_RDY / ECG_RDY interrupts and the
+  INT line (a SimulatedInterruptLine, see InterruptLine.h), and the time a transaction keeps the bus busy
+  at the configured SCL frequency.
+  Records enter the FIFO at the configured rate, with values taken from per-channel waveforms.
+
+  Time is virtual: it only moves forward through advance()/advanceTo(), bus transactions and delay(),
+  and it is the clock the driver sees through micros(). The whole thing runs on the host (it is left out of
+  Arduino builds), e.g.
+
+    SimulatedMAX86150 sim;
+    MAX86150Driver<SimulatedMAX86150> sensor;
+    sensor.begin(sim, I2C_SPEED_FAST);
+    sensor.setup(MAX86150Config<>::registers);
+    sim.advance(100000);  //100ms worth of samples
+    sensor.check();       //Drains them, and charges the bus time to the virtual clock
+ *****************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <i2c_bus.h>
+#include <InterruptLine.h>
+
+#define MAX86150_SIM_ADDRESS 0x5E
+
+//Signals the simulated front-end measures
+enum MAX86150SimSignal : uint8_t
+{
+  MAX86150_SIM_IR = 0,  //LED1
+  MAX86150_SIM_RED = 1, //LED2
+  MAX86150_SIM_ECG = 2
+};
+
+//Value of a signal [ADC counts] at time `t` [s]. PPG is clipped to 19 bits, ECG to 18 bits two's complement.
+//PPG values are scaled by the LED pulse amplitude (full scale at 0xFF).
+typedef double (*MAX86150SimWaveform)(double t);
+
+//Bus usage since construction or the last resetStats()
+struct MAX86150SimStats
+{
+  uint32_t transactions;
+  uint32_t bytes;           //Payload bytes, register address included
+  uint64_t busTime;         //[us] the bus was kept busy
+  uint32_t samplesProduced; //Records that entered the FIFO
+  uint32_t samplesLost;     //Records lost to a full FIFO (overwritten on roll-over, discarded otherwise)
+};
+
+class SimulatedMAX86150 final : public I2CBus {
+ public:
+  SimulatedMAX86150(uint8_t address = MAX86150_SIM_ADDRESS);
+
+  // I2CBus
+  void begin(uint32_t clockHz) override;
+  uint16_t maxReadLength(void) override;
+  bool writeRegisters(uint8_t address, uint8_t reg, const uint8_t *src, uint16_t length) override;
+  bool readRegisters(uint8_t address, uint8_t reg, uint8_t *dst, uint16_t length) override;
+  uint32_t micros(void) override { return (uint32_t)_now; }
+  void delay(uint32_t ms) override { advance(ms * 1000); }
+
+  // Virtual time [us]
+  uint64_t now(void) { return _now; }
+  void advance(uint32_t us);
+  void advanceTo(uint64_t t); //No-op if `t` is in the past
+
+  // Simulation settings
+  void setWaveform(MAX86150SimSignal signal, MAX86150SimWaveform waveform); //nullptr restores the default one
+  void setMaxReadLength(uint16_t length) { _maxReadLength = length; } //Default: 128 bytes, like ESP32's Wire
+  void setTransactionOverhead(uint32_t us) { _transactionOverhead = us; } //Fixed software cost added to every transaction
+
+  // The (active low) INT pin: fires on every falling edge, isAsserted() while it's low
+  InterruptLine &interruptLine(void) { return _intLine; }
+
+  // Inspection
+  uint8_t peekRegister(uint8_t reg) { return _regs[reg]; } //Reads a register without side effects
+  uint8_t getFIFOCount(void) { return _fifoCount; }
+  const MAX86150SimStats &getStats(void) { return _stats; }
+  void resetStats(void);
+  uint32_t getRecordRate(void); //FIFO records per second with the current configuration, 0 if the FIFO is stopped
+
+  // Default waveforms
+  static double defaultECG(double t); //72bpm train of QRS-like spikes
+  static double defaultIR(double t);  //72bpm pulse wave on top of a DC level
+  static double defaultRed(double t);
+
+ private:
+  uint8_t _address;
+  uint8_t _regs[256];
+
+  //FIFO: every record holds up to 4 slots of 3 bytes
+  uint8_t _fifo[32][12];
+  uint8_t _recordSize[32];
+  uint8_t _fifoCount = 0;
+  uint8_t _byteInRecord = 0; //Bytes of the record at the read pointer already sent over FIFO_DATA
+
+  //Time
+  uint64_t _now = 0;
+  double _nextSample = 0; //[us] when the next record is due
+  bool _running = false;
+  uint32_t _clockHz = 100000;
+  uint32_t _transactionOverhead = 0;
+  uint16_t _maxReadLength = 128;
+
+  MAX86150SimWaveform _waveforms[3];
+  SimulatedInterruptLine _intLine;
+
+  MAX86150SimStats _stats;
+
+  void reset(void);
+  void writeRegister(uint8_t reg, uint8_t value);
+  uint8_t readRegister(uint8_t reg);
+  uint8_t readFIFOByte(void);
+  void produceRecord(void);
+  double sampleSignal(MAX86150SimSignal signal);
+  void updateRunning(void);
+  bool isInterruptPending(void);
+  void updateInterruptLine(void);
+  void chargeBus(uint32_t bits, uint16_t bytes);
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <stdint.h>
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <driver/adc.h>
+#endif
+
+#define ADC_SCAN_PINS_MAX 4 // ADC1 pins the scanner can sweep
+#define ADC_SCAN_READ_BYTES 256 // DMA pool bytes taken per read, into a buffer of the scanner (not on the small stack of the draining task)
+#define ADC_SCAN_FRAME_BYTES 2 // One conversion, as the ESP32 DMA writes it (ADC_DIGI_OUTPUT_FORMAT_TYPE1)
+
+/* Per-pin running sums of the conversions of a scan: the platform-independent half of ADCScanner.
+ * accumulate() parses the frames the ADC digital controller writes, 16 bits little endian each: the 12-bit result in
+ * bits 0-11, its ADC1 channel in bits 12-15. takeAverage() hands over the mean of a pin since its last take.
+*/
+class ADCScanSums {
+ public:
+  // Pins and their ADC1 channels, in the same order. Returns false (and changes nothing) if there are too many
+  bool setPins(const uint8_t* pins, const uint8_t* channels, uint8_t n) {
+    if (n > ADC_SCAN_PINS_MAX) return false;
+    for (uint8_t i = 0; i < n; i++) {
+      _pins[i] = pins[i];
+      _channels[i] = channels[i];
+      _sums[i] = 0;
+      _conversions[i] = 0;
+    }
+    _count = n;
+    return true;
+  }
+
+  bool isScanning(uint8_t pin) const { return slotOf(pin) >= 0; }
+
+  // Adds the conversions in `length` bytes of frames to the sums of their pins. Channels of no pin are skipped, and so
+  // is a trailing partial frame
+  void accumulate(const uint8_t* frames, uint32_t length) {
+    for (uint32_t i = 0; i + ADC_SCAN_FRAME_BYTES <= length; i += ADC_SCAN_FRAME_BYTES) {
+      const uint16_t frame = frames[i] | (frames[i + 1] << 8);
+      const uint8_t channel = frame >> 12;
+      for (uint8_t s = 0; s < _count; s++) {
+        if (_channels[s] != channel) continue;
+        _sums[s] += frame & 0x0FFF;
+        _conversions[s]++;
+        break;
+      }
+    }
+  }
+
+  // Mean of the conversions of `pin` since its last take: a 12-bit reading, as analogRead() would give. false if there's none yet
+  bool takeAverage(uint8_t pin, uint16_t& mean) {
+    const int8_t s = slotOf(pin);
+    if (s < 0 || _conversions[s] == 0) return false;
+    mean = static_cast<uint16_t>((_sums[s] + _conversions[s] / 2) / _conversions[s]); // Rounded
+    _sums[s] = 0;
+    _conversions[s] = 0;
+    return true;
+  }
+
+ private:
+  uint8_t _pins[ADC_SCAN_PINS_MAX] = {};
+  uint8_t _channels[ADC_SCAN_PINS_MAX] = {};
+  uint32_t _sums[ADC_SCAN_PINS_MAX] = {}; // 12-bit conversions: room for a million of them
+  uint32_t _conversions[ADC_SCAN_PINS_MAX] = {};
+  uint8_t _count = 0;
+
+  int8_t slotOf(uint8_t pin) const {
+    for (uint8_t s = 0; s < _count; s++)
+      if (_pins[s] == pin) return s;
+    return -1;
+  }
+};
+
+#ifdef ARDUINO
+/* ADC1 in continuous mode: the ADC digital controller sweeps a set of pins by itself, at a fixed rate, and DMA drops the
+ * conversions in a pool held by the driver. No CPU time goes into the conversions, and they are evenly spaced by hardware.
+ * Consumers don't read the ADC: poll() drains the pool into one running sum per pin, and takeAverage() hands over the
+ * mean of a pin since its last take, i.e. a block average over the consumer's own sample period.
+ *
+ * poll() has to run often enough for the pool not to fill up (poolBytes / (2 bytes * rate) seconds): conversions that
+ * don't fit are dropped by the driver, and counted in getOverflows().
+ * Everything but begin() runs on a single task (the executor of vTask_SampleJobs): there's nothing to lock.
+ * Once it runs, analogRead() must not be used on ADC1.
+*/
+class ADCScanner : public ADCScanSums {
+  static_assert(sizeof(adc_digi_output_data_t) == ADC_SCAN_FRAME_BYTES, "ADCScanSums parses 16-bit TYPE1 frames");
+
+ public:
+  // `rateHz`: conversions per second, over all the pins (each one gets rateHz / n). The ESP32 controller can't go below 20 kHz
+  bool begin(const uint8_t* pins, uint8_t n, uint32_t rateHz, uint32_t poolBytes) {
+    if (n == 0 || n > ADC_SCAN_PINS_MAX) return false;
+
+    adc_digi_pattern_config_t pattern[ADC_SCAN_PINS_MAX] = {};
+    uint8_t channels[ADC_SCAN_PINS_MAX];
+    uint32_t channelMask = 0;
+    for (uint8_t i = 0; i < n; i++) {
+      const int8_t channel = digitalPinToAnalogChannel(pins[i]);
+      if (channel < 0 || channel >= ADC1_CHANNEL_MAX) { // ADC2 is taken by the WiFi driver
+        Serial.printf("[ADC] ERROR: Pin %u is not on ADC1.\n", pins[i]);
+        return false;
+      }
+      channels[i] = channel;
+      channelMask |= 1 << channel;
+      pattern[i].atten = ADC_ATTEN_DB_11; // Same full scale (~3.1 V) as analogRead()
+      pattern[i].channel = channel;
+      pattern[i].unit = 0; // ADC1
+      pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_digi_init_config_t init = {};
+    init.max_store_buf_size = poolBytes;
+    init.conv_num_each_intr = ADC_SCAN_READ_BYTES;
+    init.adc1_chan_mask = channelMask;
+    init.adc2_chan_mask = 0;
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = true; // Required on the ESP32
+    config.conv_limit_num = 250;
+    config.pattern_num = n;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = rateHz;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+    esp_err_t err = adc_digi_initialize(&init);
+    if (err == ESP_OK) err = adc_digi_controller_configure(&config);
+    if (err == ESP_OK) err = adc_digi_start();
+    if (err != ESP_OK) {
+      Serial.printf("[ADC] ERROR: Continuous mode failed to start (%s).\n", esp_err_to_name(err));
+      return false;
+    }
+    setPins(pins, channels, n);
+    Serial.printf("[ADC] Scanning %u pins at %u conversions/s each.\n", n, (unsigned)(rateHz / n));
+    return true;
+  }
+
+  // Moves every conversion waiting in the pool into the running sums. Never blocks
+  void poll() {
+    while (true) {
+      uint32_t length = 0;
+      const esp_err_t err = adc_digi_read_bytes(_buf, sizeof(_buf), &length, 0);
+      if (err == ESP_ERR_INVALID_STATE) _overflows++; // The pool filled up before this read: the data in it is still good
+      else if (err != ESP_OK) return; // ESP_ERR_TIMEOUT: nothing left
+
+      accumulate(_buf, length);
+      if (length < sizeof(_buf)) return;
+    }
+  }
+
+  uint32_t getOverflows() const { return _overflows; }
+
+ private:
+  uint8_t _buf[ADC_SCAN_READ_BYTES]; // Only poll() uses it, always from the same task
+  uint32_t _overflows = 0;
+};
+#endif
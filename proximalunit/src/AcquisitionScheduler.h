@@ -0,0 +1,195 @@
+#pragma once
+#include <stdint.h>
+#ifdef ARDUINO
+#include <atomic>
+#include <Arduino.h>
+#include <esp_timer.h>
+#endif
+
+#define SCHEDULER_MAX_CHANNELS 8
+
+/* Multi-rate dispatcher on a shared microsecond timebase.
+ * Each channel has a phase accumulator: every microsecond it gains `rate` [mHz], and the channel is due
+ * whenever it crosses 1 s * 1000 mHz/Hz. Rates need not divide the timebase (220 Hz -> 4545.45 us):
+ * single periods are rounded to the microsecond, but the k-th dispatch of a channel always happens at
+ * ceil(k / rate), so the average rate is exact and no drift builds up, between channels either.
+ *
+ * The scheduler is pure logic on a virtual clock: the caller moves the clock forward with advanceTo(),
+ * and can ask when the next dispatch is due with nextDue(). AcquisitionScheduler drives it with a hardware
+ * timer; on the host, any loop will do.
+*/
+class RateScheduler {
+ public:
+  static const uint64_t PHASE_WRAP = 1000000000ULL; // 1 s [us] * 1000 [mHz/Hz]
+
+  // Returns the id of the new channel (first due one period from now), or -1 if there's no room or the rate is 0
+  int8_t addChannel(uint32_t rateMilliHz) {
+    if (_channels >= SCHEDULER_MAX_CHANNELS || rateMilliHz == 0) return -1;
+    _rate[_channels] = rateMilliHz;
+    _phase[_channels] = 0;
+    _count[_channels] = 0;
+    _missed[_channels] = 0;
+    _origin[_channels] = _now;
+    return _channels++;
+  }
+
+  // Changes the rate of a channel. The period in progress is stretched or shrunk in proportion, and sample
+  // numbering (getCount(), sampleTime()) starts over from the new rate
+  bool setRate(uint8_t ch, uint32_t rateMilliHz) {
+    if (ch >= _channels || rateMilliHz == 0) return false;
+    _rate[ch] = rateMilliHz;
+    _origin[ch] = _now - _phase[ch] / rateMilliHz; // Where the current period would have started, at the new rate
+    _count[ch] = 0;
+    return true;
+  }
+
+  uint64_t now() const { return _now; } // [us]
+
+  // Time [us] of the next dispatch, over all channels. UINT64_MAX if there are no channels
+  uint64_t nextDue() const {
+    uint64_t next = UINT64_MAX;
+    for (uint8_t ch = 0; ch < _channels; ch++) {
+      const uint64_t due = _now + (PHASE_WRAP - _phase[ch] + _rate[ch] - 1) / _rate[ch];
+      if (due < next) next = due;
+    }
+    return next;
+  }
+
+  // Moves the timebase to `t` [us] and returns the mask of channels which became due (bit n -> channel n).
+  // A channel which became due more than once has missed dispatches: see getMissed()
+  uint32_t advanceTo(uint64_t t) {
+    if (t <= _now) return 0;
+    const uint64_t elapsed = t - _now;
+    uint32_t due = 0;
+    for (uint8_t ch = 0; ch < _channels; ch++) {
+      _phase[ch] += elapsed * _rate[ch];
+      if (_phase[ch] >= PHASE_WRAP) {
+        const uint64_t periods = _phase[ch] / PHASE_WRAP;
+        _phase[ch] -= periods * PHASE_WRAP;
+        _count[ch] += periods;
+        _missed[ch] += periods - 1;
+        due |= (1UL << ch);
+      }
+    }
+    _now = t;
+    return due;
+  }
+
+  uint8_t channels() const { return _channels; }
+  uint32_t getRate(uint8_t ch) const { return _rate[ch]; } // [mHz]
+  uint32_t getCount(uint8_t ch) const { return _count[ch]; } // Dispatches so far: index of the latest sample on the shared timebase
+  uint32_t getMissed(uint8_t ch) const { return _missed[ch]; } // Dispatches merged into a later one, because advanceTo() came too late
+  uint32_t period(uint8_t ch) const { return (PHASE_WRAP + _rate[ch] - 1) / _rate[ch]; } // [us] Rounded up
+
+  // Nominal time [us] of the k-th sample (k >= 1) of a channel: samples of different channels align on this
+  uint64_t sampleTime(uint8_t ch, uint32_t k) const { return (k * PHASE_WRAP + _rate[ch] - 1) / _rate[ch] + _origin[ch]; }
+
+ protected:
+  uint8_t _channels = 0;
+  uint64_t _now = 0;
+  uint32_t _rate[SCHEDULER_MAX_CHANNELS];
+  uint64_t _phase[SCHEDULER_MAX_CHANNELS];
+  uint64_t _origin[SCHEDULER_MAX_CHANNELS]; // [us] when the channel was added
+  uint32_t _count[SCHEDULER_MAX_CHANNELS];
+  uint32_t _missed[SCHEDULER_MAX_CHANNELS];
+};
+
+#ifdef ARDUINO
+/* RateScheduler driven by a single esp_timer: the timer is armed one-shot for the next due dispatch,
+ * and wakes up the sampling task of every channel which became due with a task notification.
+ * A sampling task registers itself with addTask(), then calls waitForSample() once per sample, instead of xTaskDelayUntil().
+ * A task may register several channels: the notification then only says that some are due, and takeDue() tells which.
+*/
+class AcquisitionScheduler : public RateScheduler {
+ public:
+  // Creates the timer and starts the timebase. Call it once, from setup(), before any task registers
+  bool begin() {
+    const esp_timer_create_args_t args = {_onTimer, this, ESP_TIMER_TASK, "acq_sched", true};
+    if (esp_timer_create(&args, &_timer) != ESP_OK) return false;
+    _start = esp_timer_get_time();
+    return true;
+  }
+
+  // Registers the calling task to be woken up `rateMilliHz` / 1000 times per second. Returns its channel id, or -1
+  int8_t addTask(uint32_t rateMilliHz) {
+    if (!_timer) return -1; // begin() wasn't called
+
+    portENTER_CRITICAL(&_mux);
+    const uint32_t due = advanceTo(esp_timer_get_time() - _start); // The new channel starts from now, in phase with the timebase
+    const int8_t ch = addChannel(rateMilliHz);
+    if (ch >= 0) _tasks[ch] = xTaskGetCurrentTaskHandle();
+    portEXIT_CRITICAL(&_mux);
+
+    dispatch(due); // Channels which became due on the way must still get their wake-up
+    if (ch >= 0) rearm();
+    return ch;
+  }
+
+  // Changes the rate of a channel, from any task
+  bool setTaskRate(int8_t ch, uint32_t rateMilliHz) {
+    if (ch < 0) return false;
+    portENTER_CRITICAL(&_mux);
+    const uint32_t due = advanceTo(esp_timer_get_time() - _start); // The old rate holds up to now
+    const bool ok = setRate(ch, rateMilliHz);
+    portEXIT_CRITICAL(&_mux);
+
+    dispatch(due);
+    if (ok) rearm();
+    return ok;
+  }
+
+  // Dispatches of a channel since the previous call: for tasks which wait on several channels at once
+  uint32_t takeDue(int8_t ch) {
+    return _due[ch].exchange(0, std::memory_order_acquire);
+  }
+
+  // How late [us] it is now, after the latest due time of a channel. Called on wake-up, it's the wake-up latency
+  // (up to one period short, if the task woke up so late that the channel became due again)
+  uint32_t lateness(int8_t ch) {
+    portENTER_CRITICAL(&_mux);
+    const int64_t late = esp_timer_get_time() - _start - (int64_t)sampleTime(ch, _count[ch]);
+    portEXIT_CRITICAL(&_mux);
+    return late > 0 ? late : 0;
+  }
+
+  // Blocks until the calling task's channel is due. Returns how many dispatches were pending: more than 1 means samples were missed
+  uint32_t waitForSample(TickType_t timeout = portMAX_DELAY) {
+    return ulTaskNotifyTake(pdTRUE, timeout);
+  }
+
+ private:
+  esp_timer_handle_t _timer = nullptr;
+  int64_t _start = 0; // esp_timer time of timebase 0
+  TaskHandle_t _tasks[SCHEDULER_MAX_CHANNELS] = {nullptr};
+  std::atomic<uint32_t> _due[SCHEDULER_MAX_CHANNELS] = {}; // Dispatches not taken yet, see takeDue()
+  portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+  void rearm() {
+    portENTER_CRITICAL(&_mux);
+    const int64_t wait = (int64_t)nextDue() + _start - esp_timer_get_time();
+    portEXIT_CRITICAL(&_mux);
+    esp_timer_stop(_timer); // Fails harmlessly if the timer isn't armed
+    esp_timer_start_once(_timer, wait > 0 ? wait : 1);
+  }
+
+  // Wakes up the task of every channel in the `due` mask
+  void dispatch(uint32_t due) {
+    for (uint8_t ch = 0; ch < _channels; ch++)
+      if (due & (1UL << ch)) {
+        _due[ch].fetch_add(1, std::memory_order_release);
+        xTaskNotifyGive(_tasks[ch]);
+      }
+  }
+
+  static void _onTimer(void* arg) {
+    AcquisitionScheduler* self = static_cast<AcquisitionScheduler*>(arg);
+
+    portENTER_CRITICAL(&self->_mux);
+    const uint32_t due = self->advanceTo(esp_timer_get_time() - self->_start);
+    portEXIT_CRITICAL(&self->_mux);
+
+    self->dispatch(due);
+    self->rearm();
+  }
+};
+#endif
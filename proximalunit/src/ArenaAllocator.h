@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <ArduinoJson.h>
+
+/* ArduinoJson allocator on top of a static pool of SIZE bytes: JSON documents never touch the heap.
+ * Blocks are carved out of the pool one after the other, and the whole pool is reclaimed at once
+ * when the last live block is freed. This fits a document which is cleared and refilled as a whole
+ * (deserializeJson() frees everything before parsing): every message starts again from an empty pool.
+ * A document which doesn't fit gets a NoMemory error, rather than eating into the heap.
+*/
+template <size_t SIZE>
+class ArenaAllocator : public ArduinoJson::Allocator {
+  static const size_t ALIGN = 8; // Variant slots may hold doubles
+  static const size_t HEADER = ALIGN; // Every block starts with its size, so that reallocate() knows how much to copy
+
+ public:
+  void* allocate(size_t size) override {
+    const size_t total = HEADER + aligned(size);
+    if (total > SIZE - _used) return nullptr;
+    uint8_t* block = &_pool[_used];
+    *reinterpret_cast<size_t*>(block) = size;
+    _last = _used;
+    _used += total;
+    _blocks++;
+    if (_used > _peak) _peak = _used;
+    return block + HEADER;
+  }
+
+  void deallocate(void* ptr) override {
+    if (!ptr) return;
+    if (--_blocks == 0) _used = 0;
+  }
+
+  void* reallocate(void* ptr, size_t newSize) override {
+    if (!ptr) return allocate(newSize);
+    uint8_t* block = static_cast<uint8_t*>(ptr) - HEADER;
+    const size_t offset = block - _pool;
+    const size_t oldSize = *reinterpret_cast<size_t*>(block);
+
+    if (offset == _last && HEADER + aligned(newSize) <= SIZE - offset) { // Last block: grow or shrink it in place
+      *reinterpret_cast<size_t*>(block) = newSize;
+      _used = offset + HEADER + aligned(newSize);
+      if (_used > _peak) _peak = _used;
+      return ptr;
+    }
+
+    void* moved = allocate(newSize);
+    if (!moved) return nullptr;
+    memcpy(moved, ptr, (oldSize < newSize) ? oldSize : newSize);
+    deallocate(ptr);
+    return moved;
+  }
+
+  size_t capacity() const { return SIZE; }
+  size_t peak() const { return _peak; } // Highest pool usage so far [bytes]
+
+ private:
+  alignas(ALIGN) uint8_t _pool[SIZE];
+  size_t _used = 0;
+  size_t _last = 0;   // Offset of the most recent block
+  size_t _blocks = 0; // Live blocks
+  size_t _peak = 0;
+
+  static size_t aligned(size_t size) { return (size + ALIGN - 1) & ~(ALIGN - 1); }
+};
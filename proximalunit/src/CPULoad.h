@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
+
+#define CPU_LOAD_IDLE_GAP 20 // [us] Calls of the idle hook closer than this mean the core stayed idle in between
+
+/* Per-core load, measured from each core's idle task.
+ * An idle hook runs over and over while a core has nothing else to do: time between two consecutive calls
+ * counts as idle if they are close enough, while a longer gap means some task (or a long ISR) ran in between.
+ * Everything outside the idle task counts as load, WiFi and the system tasks included.
+ *
+ * The hook keeps the idle tasks spinning instead of waiting for an interrupt (the default), which costs some power:
+ * only begin() the monitor if the figures are needed.
+*/
+class CPULoadMonitor {
+ public:
+  void begin() {
+    for (uint8_t cpu = 0; cpu < portNUM_PROCESSORS; cpu++) _lastSample[cpu] = micros();
+    esp_register_freertos_idle_hook_for_cpu(_onIdlePRO, PRO_CPU_NUM);
+    esp_register_freertos_idle_hook_for_cpu(_onIdleAPP, APP_CPU_NUM);
+  }
+
+  // Share [%] of the time core `cpu` was busy since the previous call for the same core
+  float sample(uint8_t cpu) {
+    const uint32_t now = micros();
+    const uint32_t idle = _idleTime[cpu]; // Single aligned 32-bit word: read atomically from the other core too
+    const uint32_t elapsed = now - _lastSample[cpu];
+    const uint32_t idleSince = idle - _lastIdle[cpu];
+    _lastSample[cpu] = now;
+    _lastIdle[cpu] = idle;
+    if (elapsed == 0 || idleSince >= elapsed) return 0;
+    return 100.0f * (elapsed - idleSince) / elapsed;
+  }
+
+ private:
+  uint32_t _lastSample[portNUM_PROCESSORS];
+  uint32_t _lastIdle[portNUM_PROCESSORS] = {0};
+
+  // Written by the idle hook of each core only. [us], wrapping around every ~71 minutes: sample() works on differences
+  static inline volatile uint32_t _idleTime[portNUM_PROCESSORS] = {0};
+  static inline uint32_t _lastHook[portNUM_PROCESSORS] = {0};
+
+  static bool _onIdle(uint8_t cpu) {
+    const uint32_t now = micros();
+    const uint32_t gap = now - _lastHook[cpu];
+    if (gap < CPU_LOAD_IDLE_GAP) _idleTime[cpu] += gap;
+    _lastHook[cpu] = now;
+    return false; // Keep the idle task looping, so that the next call comes right away
+  }
+  static bool _onIdlePRO() { return _onIdle(PRO_CPU_NUM); }
+  static bool _onIdleAPP() { return _onIdle(APP_CPU_NUM); }
+};
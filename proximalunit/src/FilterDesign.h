@@ -0,0 +1,117 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Filter design at compile time: coefficients are computed by the compiler from the sample rate and the band edges,
+ * and land in flash as fixed-point constants. Change a rate or an edge, and the coefficients follow, at no run time cost.
+ * Designs are constexpr objects, handed to the filter stages of Filters.h by reference:
+ *   constexpr auto LOWPASS = designFIR<long, 31>(200, 0, 25, 14);
+ *   SymmetricFIR<long, 31, LOWPASS> lowpass;
+*/
+
+namespace filterdesign {
+  constexpr double PI = 3.14159265358979323846;
+
+  // sin(x), with x brought back to [-pi, pi] first: the series converges to double precision within 30 terms
+  constexpr double sine(double x) {
+    const long turns = static_cast<long>(x / (2 * PI));
+    x -= turns * 2 * PI;
+    if (x > PI) x -= 2 * PI;
+    if (x < -PI) x += 2 * PI;
+    double term = x, sum = x;
+    for (int k = 1; k < 30; k++) {
+      term *= -x * x / ((2 * k) * (2 * k + 1));
+      sum += term;
+    }
+    return sum;
+  }
+
+  constexpr double cosine(double x) { return sine(x + PI / 2); }
+
+  constexpr double absolute(double x) { return x < 0 ? -x : x; }
+
+  constexpr long roundToLong(double x) { return static_cast<long>(x < 0 ? x - 0.5 : x + 0.5); }
+
+  // Ideal low-pass with cut-off `fc` (as a fraction of the sample rate), at tap offset `m` from the center
+  constexpr double idealLowPass(double fc, double m) {
+    return (m == 0) ? 2 * fc : sine(2 * PI * fc * m) / (PI * m);
+  }
+}
+
+// Taps of a FIR filter, scaled by 2^frac
+template <class T, size_t N>
+struct FIRTaps {
+  T taps[N];
+  uint8_t frac;
+};
+
+/* Windowed-sinc FIR (Hamming window) passing [fLow, fHigh] Hz at `fs` Hz: fLow = 0 --> low-pass, fHigh >= fs/2 --> high-pass.
+ * The edges are the -6 dB points.
+ * The gain is normalized to 1 in the middle of the band (at DC for a low-pass, at fs/2 for a high-pass), then the taps are
+ * rounded to `frac` fractional bits. The taps come out symmetric, as SymmetricFIR wants them.
+ * The transition bands are about 3.3 * fs / N wide: an edge closer than that to 0 or fs/2 won't be resolved.
+*/
+template <class T, size_t N>
+constexpr FIRTaps<T, N> designFIR(double fs, double fLow, double fHigh, uint8_t frac) {
+  using namespace filterdesign;
+  double h[N] = {};
+  const double lo = fLow / fs;
+  const double hi = (fHigh >= fs / 2) ? 0.5 : fHigh / fs;
+  for (size_t n = 0; n < N; n++) {
+    const double m = n - (N - 1) / 2.0;
+    const double window = (N > 1) ? 0.54 - 0.46 * cosine(2 * PI * n / (N - 1)) : 1;
+    h[n] = window * (idealLowPass(hi, m) - idealLowPass(lo, m));
+  }
+
+  // Gain at the reference frequency: the taps are symmetric, so the response there is real
+  const double fRef = (lo == 0) ? 0 : (hi == 0.5) ? 0.5 : (lo + hi) / 2;
+  double gain = 0;
+  for (size_t n = 0; n < N; n++) gain += h[n] * cosine(2 * PI * fRef * (n - (N - 1) / 2.0));
+
+  FIRTaps<T, N> design = {};
+  for (size_t n = 0; n < N; n++) design.taps[n] = static_cast<T>(roundToLong(h[n] / absolute(gain) * (1L << frac)));
+  design.frac = frac;
+  return design;
+}
+
+// Second-order section y = b0*x + b1*x[-1] + b2*x[-2] - a1*y[-1] - a2*y[-2], coefficients scaled by 2^frac
+struct BiquadCoeffs {
+  int32_t b0, b1, b2, a1, a2;
+  uint8_t frac;
+};
+
+enum BiquadType : uint8_t {
+  BIQUAD_LOWPASS,
+  BIQUAD_HIGHPASS,
+  BIQUAD_BANDPASS, // Constant 0 dB peak gain
+  BIQUAD_NOTCH
+};
+
+#define BIQUAD_Q_BUTTERWORTH 0.70710678118654752 // 1/sqrt(2): maximally flat
+#define BIQUAD_Q_NOTCH 10 // The notch is a tenth of its frequency wide: tolerant to mains frequency drift
+
+/* Biquad section at `fs` Hz, with corner (or center) frequency `f0` Hz and quality factor `q` (RBJ audio EQ cookbook).
+ * The coefficients are rounded to `frac` fractional bits: 30 leaves room for the a1 coefficient, which gets close to -2
+ * for corners far below fs/2.
+ * Being constexpr doesn't keep it from running on the target too: filter chains from the config message are designed there,
+ * by the config handler (never in the sampling tasks: it takes double-precision software floating point).
+*/
+constexpr BiquadCoeffs designBiquad(BiquadType type, double fs, double f0, double q, uint8_t frac = 30) {
+  using namespace filterdesign;
+  const double w0 = 2 * PI * f0 / fs;
+  const double c = cosine(w0);
+  const double alpha = sine(w0) / (2 * q);
+  const double a0 = 1 + alpha;
+
+  double b0 = 0, b1 = 0, b2 = 0;
+  switch (type) {
+    case BIQUAD_LOWPASS:  b0 = (1 - c) / 2; b1 = 1 - c;    b2 = (1 - c) / 2; break;
+    case BIQUAD_HIGHPASS: b0 = (1 + c) / 2; b1 = -(1 + c); b2 = (1 + c) / 2; break;
+    case BIQUAD_BANDPASS: b0 = alpha;       b1 = 0;        b2 = -alpha;      break;
+    case BIQUAD_NOTCH:    b0 = 1;           b1 = -2 * c;   b2 = 1;           break;
+  }
+
+  const double scale = static_cast<double>(1L << frac) / a0;
+  return {static_cast<int32_t>(roundToLong(b0 * scale)), static_cast<int32_t>(roundToLong(b1 * scale)), static_cast<int32_t>(roundToLong(b2 * scale)),
+          static_cast<int32_t>(roundToLong(-2 * c * scale)), static_cast<int32_t>(roundToLong((1 - alpha) * scale)), frac};
+}
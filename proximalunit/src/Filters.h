@@ -0,0 +1,342 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <limits>
+#include <type_traits>
+#include <FilterDesign.h>
+
+/* Filter stages for the acquisition pipeline.
+ * A filter stage is a class with:
+ *   process(x)       takes one sample and returns the filtered one
+ *   process(x, n)    filters a block of n samples in place (e.g. a whole FIFO burst), as n calls of process(x) would
+ * Stages keep their own history, so every stream needs its own instance (which is what SignalStream does).
+ * They are pure computation, with no dependency on the platform: they build and run on the host as they are.
+*/
+
+// Chains any number of stages: FilterChain<A, B> runs A, then B. FilterChain<> lets samples through unchanged
+template <class... Stages> class FilterChain;
+
+template <> class FilterChain<> {
+ public:
+  template <class T> T process(T x) { return x; }
+  template <class T> void process(T* x, uint16_t n) {}
+};
+
+template <class First, class... Rest> class FilterChain<First, Rest...> {
+ public:
+  template <class T> auto process(T x) { return _rest.process(_first.process(x)); }
+
+  // Stage by stage over the whole block: each stage keeps its loop (and its state) hot
+  template <class T> void process(T* x, uint16_t n) {
+    _first.process(x, n);
+    _rest.process(x, n);
+  }
+
+ private:
+  First _first;
+  FilterChain<Rest...> _rest;
+};
+
+typedef FilterChain<> NoFilter;
+
+// ## Fixed-point helpers ##
+namespace fixedpoint {
+  // Clamps `x` to the range of T (integral T only: floating point values just get converted)
+  template <class T, class W>
+  T saturate(W x) {
+    if constexpr (std::is_integral<T>::value) {
+      typedef typename std::common_type<T, W>::type Wide; // Compared in a type holding both ranges
+      if (static_cast<Wide>(x) > static_cast<Wide>(std::numeric_limits<T>::max())) return std::numeric_limits<T>::max();
+      if (static_cast<Wide>(x) < static_cast<Wide>(std::numeric_limits<T>::min())) return std::numeric_limits<T>::min();
+    }
+    return static_cast<T>(x);
+  }
+
+  // a + b, clamped to the range of T instead of wrapping around
+  template <class T>
+  T addSat(T a, T b) {
+    T sum;
+    if (__builtin_add_overflow(a, b, &sum)) return (b > 0) ? std::numeric_limits<T>::max() : std::numeric_limits<T>::min();
+    return sum;
+  }
+}
+
+// Moving average over the last N samples, kept as a running total in `Acc` (which must fit N full-scale samples)
+template <class T, class Acc, uint16_t N>
+class MovingAverage {
+  static_assert(N > 0, "MovingAverage needs at least 1 sample");
+ public:
+  T process(T x) {
+    _total += static_cast<Acc>(x) - static_cast<Acc>(_history[_idx]);
+    _history[_idx] = x;
+    if (++_idx >= N) _idx = 0;
+    return static_cast<T>(_total / N);
+  }
+
+  template <class U> void process(U* x, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) x[i] = process(static_cast<T>(x[i]));
+  }
+
+ private:
+  T _history[N] = {}; // Starts from a zero history: the output ramps up over the first N samples
+  Acc _total = 0;
+  uint16_t _idx = 0;
+};
+
+// Drops the BITS least significant bits (arithmetic shift: the sign of signed samples is kept)
+template <uint8_t BITS>
+struct ShiftRight {
+  template <class T> T process(T x) { return x >> BITS; }
+  template <class T> void process(T* x, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) x[i] >>= BITS;
+  }
+};
+
+// Whether coefficients read the same both ways (linear-phase FIR)
+template <class T, size_t N>
+constexpr bool isSymmetric(const T (&coeffs)[N]) {
+  for (size_t i = 0; i < N / 2; i++)
+    if (coeffs[i] != coeffs[N - 1 - i]) return false;
+  return true;
+}
+
+/* FIR filter with symmetric taps fixed at compile time (see designFIR()): y[n] = sum of taps[i] * x[n-i] / 2^frac, computed in T.
+ * Taps sharing a coefficient are added up before multiplying, which takes (N+1)/2 multiplies instead of N.
+ * The history is stored twice in a row: the last N samples are always contiguous, so nothing is ever shifted,
+ * and there is no wrap-around to check in the inner loop.
+ * T must hold the sum of the products before scaling: about |x| * 2^frac * (sum of |taps|) / 2^frac.
+*/
+template <class T, size_t N, const FIRTaps<T, N>& TAPS>
+class SymmetricFIR {
+  static constexpr const T (&COEFFS)[N] = TAPS.taps;
+  static_assert(N > 0, "A FIR needs at least 1 tap");
+  static_assert(isSymmetric(TAPS.taps), "SymmetricFIR needs symmetric coefficients");
+
+ public:
+  T process(T x) {
+    if (_idx == 0) _idx = N;
+    _idx--;
+    _history[_idx] = x;
+    _history[_idx + N] = x;
+
+    const T* h = &_history[_idx]; // h[i] = x[n-i], for i in [0, N)
+    T y = 0;
+    for (size_t i = 0; i < N / 2; i++) y += COEFFS[i] * (h[i] + h[N - 1 - i]);
+    if (N % 2) y += COEFFS[N / 2] * h[N / 2];
+    return TAPS.frac ? (y + (static_cast<T>(1) << (TAPS.frac - 1))) >> TAPS.frac : y; // Rounded
+  }
+
+  template <class U> void process(U* x, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) x[i] = static_cast<U>(process(static_cast<T>(x[i])));
+  }
+
+ private:
+  T _history[2 * N] = {}; // Starts from a zero history
+  size_t _idx = 0; // Where the newest sample is
+};
+
+/* Biquad section with coefficients fixed at compile time (see designBiquad()), in direct form I:
+ * the state is made of past inputs and outputs, in the units of the samples, and the products add up in 64 bits.
+ * The bits dropped from the output are fed back into the next sample (see BiquadCascade).
+*/
+template <const BiquadCoeffs& C>
+class Biquad {
+ public:
+  template <class T> T process(T x) {
+    const int64_t acc = (int64_t)C.b0 * x + (int64_t)C.b1 * _x1 + (int64_t)C.b2 * _x2 - (int64_t)C.a1 * _y1 - (int64_t)C.a2 * _y2 + _err;
+    const int32_t y = static_cast<int32_t>(acc >> C.frac);
+    _err = acc - (static_cast<int64_t>(y) << C.frac);
+    _x2 = _x1;
+    _x1 = static_cast<int32_t>(x);
+    _y2 = _y1;
+    _y1 = y;
+    return static_cast<T>(y);
+  }
+
+  template <class U> void process(U* x, uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) x[i] = process(x[i]);
+  }
+
+ private:
+  int32_t _x1 = 0, _x2 = 0, _y1 = 0, _y2 = 0;
+  int64_t _err = 0;
+};
+
+/* Cascade of up to MAX_SECTIONS biquad sections, set up at run time, in fixed point with saturating arithmetic.
+ * Coefficients are `Coeff` words with FRAC fractional bits, the state is made of `State` words (past inputs and outputs,
+ * in the units of the samples), and products add up in `Acc`. Nothing wraps around: an overflow sticks to the
+ * largest value, on the accumulator as on the state, so an out-of-range sample clips instead of ringing.
+ * Each section feeds the bits its output drops back into the next sample (first-order error feedback): otherwise the
+ * rounding error comes out amplified by 1/(1+a1+a2) at DC, which is a standing offset of hundreds of counts for corners close to DC.
+ * With no sections, samples go through untouched.
+*/
+template <class Coeff, class State, class Acc, uint8_t FRAC, uint8_t MAX_SECTIONS>
+class BiquadCascade {
+  static_assert(sizeof(Acc) >= sizeof(Coeff) + sizeof(State), "Products must fit the accumulator");
+
+ public:
+  // Takes designBiquad() sections, converted to FRAC fractional bits. The state starts over from zero
+  bool setSections(const BiquadCoeffs* sections, uint8_t n) {
+    if (n > MAX_SECTIONS) return false;
+    for (uint8_t s = 0; s < n; s++) {
+      const BiquadCoeffs& c = sections[s];
+      _sections[s] = {convert(c.b0, c.frac), convert(c.b1, c.frac), convert(c.b2, c.frac), convert(c.a1, c.frac), convert(c.a2, c.frac), 0, 0, 0, 0, 0};
+    }
+    _count = n;
+    return true;
+  }
+
+  uint8_t sections() const { return _count; }
+
+  template <class T> T process(T x) {
+    if (_count == 0) return x;
+    using fixedpoint::addSat;
+    State in = fixedpoint::saturate<State>(x);
+    for (uint8_t s = 0; s < _count; s++) {
+      Section& k = _sections[s];
+      Acc acc = addSat<Acc>(static_cast<Acc>(k.b0) * in, k.err);
+      acc = addSat<Acc>(acc, static_cast<Acc>(k.b1) * k.x1);
+      acc = addSat<Acc>(acc, static_cast<Acc>(k.b2) * k.x2);
+      acc = addSat<Acc>(acc, -static_cast<Acc>(k.a1) * k.y1);
+      acc = addSat<Acc>(acc, -static_cast<Acc>(k.a2) * k.y2);
+      const Acc y = acc >> FRAC;
+      const State out = fixedpoint::saturate<State>(y);
+      k.err = (out == y) ? acc - (y << FRAC) : 0; // Nothing to carry over from a clipped output
+      k.x2 = k.x1;
+      k.x1 = in;
+      k.y2 = k.y1;
+      k.y1 = out;
+      in = out;
+    }
+    return fixedpoint::saturate<T>(in);
+  }
+
+  template <class U> void process(U* x, uint16_t n) {
+    if (_count == 0) return;
+    for (uint16_t i = 0; i < n; i++) x[i] = process(x[i]);
+  }
+
+ private:
+  struct Section {
+    Coeff b0, b1, b2, a1, a2;
+    State x1, x2, y1, y2;
+    Acc err; // Fractional bits dropped from the last output
+  };
+  Section _sections[MAX_SECTIONS];
+  uint8_t _count = 0;
+
+  static Coeff convert(int32_t c, uint8_t frac) {
+    if (frac <= FRAC) return fixedpoint::saturate<Coeff>(static_cast<int64_t>(c) << (FRAC - frac));
+    const uint8_t shift = frac - FRAC;
+    return fixedpoint::saturate<Coeff>((static_cast<int64_t>(c) + (1LL << (shift - 1))) >> shift);
+  }
+};
+
+/* Q15: 16-bit coefficients (Q2.13, as a1 needs room up to -2) and state, 32-bit accumulator. Half the memory and
+ * cheaper products, for 16-bit signal ranges and corners not much below fs/100.
+ * Q31: 32-bit coefficients (Q2.30) and state, 64-bit accumulator. For wide signal ranges, or corners close to DC.
+*/
+template <uint8_t MAX_SECTIONS> using BiquadCascadeQ15 = BiquadCascade<int16_t, int16_t, int32_t, 13, MAX_SECTIONS>;
+template <uint8_t MAX_SECTIONS> using BiquadCascadeQ31 = BiquadCascade<int32_t, int32_t, int64_t, 30, MAX_SECTIONS>;
+
+/* Decimating stages, which bring a block down to a lower rate:
+ *   decimate(x, n)   takes n samples at the input rate, writes the ones at the output rate over the head of `x`
+ *                    (in place), and returns how many it wrote
+ * The phase carries over from a block to the next: bursts of any length add up to one stream at 1/R of the rate.
+*/
+
+// Chains decimating stages: DecimatorChain<A, B> decimates by A, then by B. DecimatorChain<> lets samples through
+template <class... Stages> class DecimatorChain;
+
+template <> class DecimatorChain<> {
+ public:
+  template <class T> uint16_t decimate(T* x, uint16_t n) { return n; }
+};
+
+template <class First, class... Rest> class DecimatorChain<First, Rest...> {
+ public:
+  template <class T> uint16_t decimate(T* x, uint16_t n) { return _rest.decimate(x, _first.decimate(x, n)); }
+
+ private:
+  First _first;
+  DecimatorChain<Rest...> _rest;
+};
+
+/* CIC (Hogenauer) decimator by R, of ORDER integrator-comb pairs: a moving sum of R samples, ORDER times over, with no
+ * multiplies at all. ORDER adds per input sample, and ORDER subtractions per output one.
+ * The integrators are meant to wrap around (unsigned arithmetic): the output comes out right as long as `Acc` holds
+ * input bits + ORDER * log2(R). R is a power of 2, so the gain of R^ORDER is taken out by a (rounded) shift.
+ * Its response falls off as sinc^ORDER: the nulls sit on the multiples of the output rate, which is where the aliases
+ * of the low band come from. The band edge needs to stay well below the output rate.
+*/
+template <class Acc, uint8_t ORDER, uint8_t R>
+class CICDecimator {
+  static_assert(ORDER > 0 && R > 0 && (R & (R - 1)) == 0, "CICDecimator needs a power of 2 decimation");
+  typedef typename std::make_unsigned<Acc>::type Register;
+  static constexpr uint8_t SHIFT = ORDER * __builtin_ctz(R);
+  static_assert(SHIFT < 8 * sizeof(Acc), "CICDecimator gain doesn't fit the accumulator");
+
+ public:
+  template <class T> uint16_t decimate(T* x, uint16_t n) {
+    if constexpr (R == 1) {
+      return n;
+    } else {
+      uint16_t out = 0;
+      for (uint16_t i = 0; i < n; i++) {
+        Register v = static_cast<Register>(static_cast<Acc>(x[i]));
+        for (uint8_t k = 0; k < ORDER; k++) v = (_integrators[k] += v);
+        if (++_phase < R) continue;
+        _phase = 0;
+        for (uint8_t k = 0; k < ORDER; k++) {
+          const Register d = v - _combs[k];
+          _combs[k] = v;
+          v = d;
+        }
+        x[out++] = static_cast<T>((static_cast<Acc>(v) + (static_cast<Acc>(1) << (SHIFT - 1))) >> SHIFT); // Rounded
+      }
+      return out;
+    }
+  }
+
+ private:
+  Register _integrators[ORDER] = {};
+  Register _combs[ORDER] = {};
+  uint8_t _phase = 0;
+};
+
+/* FIR decimator by M, with symmetric taps fixed at compile time (see designFIR(), for a low-pass at the output rate).
+ * The FIR only runs for the samples that are kept: (N+1)/2 multiplies per output sample, i.e. about N/(2M) per input
+ * sample, as the polyphase form would take. The history is stored twice, as in SymmetricFIR.
+ * T must hold the products of the samples with the taps, as in SymmetricFIR.
+*/
+template <class T, size_t N, const FIRTaps<T, N>& TAPS, uint8_t M>
+class PolyphaseDecimator {
+  static constexpr const T (&COEFFS)[N] = TAPS.taps;
+  static_assert(N > 0 && M > 0, "A FIR decimator needs at least 1 tap");
+  static_assert(isSymmetric(TAPS.taps), "PolyphaseDecimator needs symmetric coefficients");
+
+ public:
+  template <class U> uint16_t decimate(U* x, uint16_t n) {
+    uint16_t out = 0;
+    for (uint16_t i = 0; i < n; i++) {
+      if (_idx == 0) _idx = N;
+      _idx--;
+      _history[_idx] = static_cast<T>(x[i]);
+      _history[_idx + N] = static_cast<T>(x[i]);
+      if (++_phase < M) continue;
+      _phase = 0;
+
+      const T* h = &_history[_idx];
+      T y = 0;
+      for (size_t k = 0; k < N / 2; k++) y += COEFFS[k] * (h[k] + h[N - 1 - k]);
+      if (N % 2) y += COEFFS[N / 2] * h[N / 2];
+      x[out++] = static_cast<U>(TAPS.frac ? (y + (static_cast<T>(1) << (TAPS.frac - 1))) >> TAPS.frac : y); // Rounded
+    }
+    return out;
+  }
+
+ private:
+  T _history[2 * N] = {}; // Starts from a zero history
+  size_t _idx = 0;
+  uint8_t _phase = 0;
+};
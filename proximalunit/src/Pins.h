@@ -1,3 +1,4 @@
 #define PIN_TEMPERATURE 34
+#define PIN_MAX86150_INT 27 // MAX86150 INT output (active-low, open-drain)
 //#define PIN_SCL
 //#define PIN_SDA
@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+/* Wait-free single-producer / single-consumer ring buffer of N (a power of 2) elements.
+ * One task may push() and another may pop(), concurrently, without locks nor critical sections:
+ * each side only writes its own index, and publishes it with a release store once the data is in place.
+ * The indexes run freely over 32 bits, so a full ring holds all N elements, and writeIndex()/readIndex()
+ * count every element that ever went through.
+ *
+ * Neither side ever blocks: push() on a full ring and pop() on an empty one just return.
+ *
+ * The consumer can also work in place: window() points at elements still in the ring, and release() hands them back
+ * to the producer once it's done with them. The first MIRROR slots are mirrored past the end of the buffer
+ * (the producer writes them twice), so any window of up to MIRROR elements is contiguous, even across the wrap-around.
+*/
+template <class T, uint32_t N, uint32_t MIRROR = 0>
+class SPSCRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "The ring size must be a power of 2");
+  static_assert(MIRROR <= N, "Windows can't be longer than the ring");
+  static_assert(std::is_trivially_copyable<T>::value, "Elements are moved around with memcpy");
+
+ public:
+  static const uint32_t CAPACITY = N;
+
+  // Producer side. Returns false, without touching the ring, if it's full
+  bool push(const T& x) {
+    const uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= N) return false;
+    const uint32_t slot = head & MASK;
+    _buf[slot] = x;
+    if (slot < MIRROR) _buf[N + slot] = x;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if the ring is empty
+  bool pop(T& x) {
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) return false;
+    x = _buf[tail & MASK];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: moves up to `max` elements to `dst`, with at most two memcpy. Returns how many were moved
+  uint32_t pop(T* dst, uint32_t max) {
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t n = _head.load(std::memory_order_acquire) - tail;
+    if (n > max) n = max;
+
+    const uint32_t start = tail & MASK;
+    const uint32_t first = (n < N - start) ? n : N - start; // Up to the end of the buffer, then wrap around
+    memcpy(dst, &_buf[start], first * sizeof(T));
+    memcpy(dst + first, _buf, (n - first) * sizeof(T));
+
+    _tail.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  // Consumer side: the elements from index `from` on (as counted by readIndex()), in place. Up to MIRROR of them are contiguous.
+  // They must have been pushed, and not released yet
+  const T* window(uint32_t from) const { return &_buf[from & MASK]; }
+
+  // Consumer side: hands the elements before index `upTo` back to the producer, without copying them out
+  void release(uint32_t upTo) { _tail.store(upTo, std::memory_order_release); }
+
+  // Elements waiting to be popped. Exact from the consumer side, a lower bound of the free room from the producer side
+  uint32_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+
+  uint32_t writeIndex() const { return _head.load(std::memory_order_acquire); } // Elements pushed so far
+  uint32_t readIndex() const { return _tail.load(std::memory_order_acquire); }  // Elements popped so far
+
+ private:
+  static const uint32_t MASK = N - 1;
+  T _buf[N + MIRROR];
+  std::atomic<uint32_t> _head{0}; // Written by the producer only
+  std::atomic<uint32_t> _tail{0}; // Written by the consumer only
+};
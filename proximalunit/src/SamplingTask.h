@@ -0,0 +1,542 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <type_traits>
+#include <atomic>
+#include <tuple>
+#include <algorithm>
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <espMqttClientAsync.h>
+#include <AcquisitionScheduler.h>
+#endif
+#include <Filters.h>
+#include <SPSCRing.h>
+#include <TaskTiming.h>
+
+/* Generic acquisition pipeline: sensor policy -> filter chain -> ring -> (publisher task) packet -> MQTT.
+ *
+ * A signal with tight deadlines gets a task of its own, vTask_Sample<Sensor>. A sensor policy is a class which provides:
+ *   static constexpr const char* NAME;   // Tag for the Serial log
+ *   static const uint32_t RATE;          // [mHz] Boot-time wake-up rate on the shared timebase. 0 --> the sensor paces itself through wait()
+ *   bool begin();                        // Sets up the sensor and its streams, from the task. false --> the task quits
+ *   void pacedBy(int8_t channel);        // Hands the scheduler channel (-1 when RATE == 0) to the streams whose rate may change live,
+ *                                        // and -1 to the others: that's when the streams are published
+ *   uint32_t wait();                     // Only when RATE == 0: blocks until there is data, returns how many wake-ups were pending
+ *   void sample(uint32_t pending);       // Reads the sensor, and pushes the new sample(s) into its streams
+ *
+ * Low-rate signals share a single task instead, vTask_SampleJobs<Jobs...>: see the cooperative executor below.
+ *
+ * Policies, filters (see Filters.h) and streams are plain classes with statically sized buffers: each instantiation is specialized
+ * at compile time, and nothing is allocated at run time.
+*/
+
+#ifdef ARDUINO
+// Defined in main.cpp
+extern espMqttClientAsync mqttClient;
+extern AcquisitionScheduler acquisitionScheduler;
+extern char topicPrefix[];
+
+// ## Packet stream ##
+#define SIGNAL_STREAMS_MAX 8 // How many streams the publisher can serve
+#define SIGNAL_BIQUADS_MAX 4 // Biquad sections a stream's filter chain can be given through the config message
+
+/* Filter chain of a stream, as the config message describes it: biquad sections, run after the stream's own Filter.
+ * The config handler designs it (designBiquad()) for the rate of the stream, and again whenever it asks for a new rate:
+ * the sampling task only gets the finished BiquadChain.
+*/
+struct FilterSpec {
+  struct Section {
+    BiquadType type;
+    float f0; // [Hz] Corner, or center, frequency
+    float q;  // <= 0 --> the default for the type: Butterworth, or BIQUAD_Q_NOTCH for a notch
+  };
+  Section sections[SIGNAL_BIQUADS_MAX];
+  uint8_t count; // 0 --> no sections: samples go through untouched
+};
+
+// A FilterSpec designed for one rate, as the sampling task swaps it into the cascade
+struct BiquadChain {
+  BiquadCoeffs sections[SIGNAL_BIQUADS_MAX];
+  uint8_t count;
+  uint32_t rate; // [mHz] The rate it was designed for: it's only taken at that rate
+};
+
+// A stream, as seen by the publisher task and by the config handler
+class PublishedStream {
+ public:
+  virtual bool publishPending() = 0; // Packs the samples waiting in the ring, publishing every full packet. false --> a publish failed, and will be retried
+  virtual uint32_t getOverruns() = 0; // Samples dropped so far because the ring was full
+  virtual const char* getTopic() = 0;
+  virtual const char* getName() = 0;
+
+  // Asks for a new rate [mHz] (0 --> keep it) and packet layout, applied by the sampling task at the next packet boundary.
+  // Returns false if the stream can't take them: the request is ignored
+  virtual bool requestConfig(uint32_t rateMilliHz, uint16_t npacket, uint16_t overlay) = 0;
+  // Designs a new filter chain, applied by the sampling task at the next packet boundary. Returns false if it can't take it
+  virtual bool requestFilters(const FilterSpec& spec) = 0;
+  virtual bool isPaced() = 0; // Whether the rate can be changed: sensors which pace themselves ignore requested rates
+  virtual void followRate() = 0; // Designs the filter chain again if the sensor moved to another rate by itself (see SignalStream::setRate())
+};
+
+/* Registry of the streams the publisher task has to serve.
+ * Streams add themselves from the sampling tasks, while the publisher may be iterating: the count is published after the slot.
+ * add() itself must not run from two tasks at once, which holds as the sampling tasks start up one after the other.
+*/
+class StreamPublisher {
+ public:
+  void add(PublishedStream* stream) {
+    const uint8_t n = _count.load(std::memory_order_relaxed);
+    for (uint8_t i = 0; i < n; i++)
+      if (_streams[i] == stream) return; // Already registered (the sampling task was restarted)
+    if (n >= SIGNAL_STREAMS_MAX) return;
+    _streams[n] = stream;
+    _count.store(n + 1, std::memory_order_release);
+  }
+
+  uint8_t count() { return _count.load(std::memory_order_acquire); }
+  PublishedStream* stream(uint8_t i) { return _streams[i]; }
+
+  PublishedStream* find(const char* name) {
+    const uint8_t n = count();
+    for (uint8_t i = 0; i < n; i++)
+      if (!strcmp(_streams[i]->getName(), name)) return _streams[i];
+    return nullptr;
+  }
+
+  // Config handler: lets every stream follow the rate its sensor declared
+  void followRates() {
+    const uint8_t n = count();
+    for (uint8_t i = 0; i < n; i++) _streams[i]->followRate();
+  }
+
+  // Publisher task: serves every stream once. Returns false if some packet couldn't be published
+  bool publishAll() {
+    bool ok = true;
+    const uint8_t n = count();
+    for (uint8_t i = 0; i < n; i++)
+      ok &= _streams[i]->publishPending();
+    return ok;
+  }
+
+ private:
+  PublishedStream* _streams[SIGNAL_STREAMS_MAX] = {nullptr};
+  std::atomic<uint8_t> _count{0};
+};
+
+extern StreamPublisher streamPublisher; // Defined in main.cpp
+
+// Smallest power of 2 holding `n` samples
+constexpr uint32_t ringSizeFor(uint32_t n) { return (n <= 1) ? 1 : 2 * ringSizeFor((n + 1) / 2); }
+
+/* Stream of one signal, split between two tasks:
+ * - the sampling task push()es samples: they go through the Filter, get converted to `Sample` and land in a wait-free ring.
+ *   Nothing on this side can block, so network stalls never reach the sampling deadlines.
+ * - the publisher task publishes them in packets of `npacket` samples, on `<topicPrefix><name>`.
+ *   Every packet starts with the last `overlay` samples of the previous one. If a publish fails, the packet is kept
+ *   and retried, while the ring (RING samples: by default 4 boot-time packets' worth) absorbs the stall.
+ * The remoteunit expects 16-bit little-endian integers.
+ *
+ * Packets are never copied out of the ring: a packet is a window of `npacket` samples on it (mirrored, so that it's
+ * contiguous across the wrap-around), and the next one starts `npacket - overlay` samples later.
+ * Samples go back to the sampling task only once the next window starts past them, and the transport is done
+ * with the packet (espMqttClient::publish() copies the payload). Meanwhile, the sampling task keeps pushing.
+ *
+ * Packets start as NPACKET samples with an OVERLAY, and can be reconfigured live up to NPACKET_MAX samples.
+ * Both sides count samples the same way, so the sampling task knows which push() completes a packet: a new layout
+ * (and rate) is applied right there, and leaves a marker in the ring, at which the publisher switches layout too.
+ * No sample is lost, and every packet is homogeneous. The overlay is carried over, unless the rate changed.
+ * A restart() is a marker too, which drops the packet in progress instead.
+ *
+ * After the Filter fixed at compile time, samples go through a Cascade of biquads set from the config message
+ * (requestFilters()), empty until then. The config handler designs it, and it's swapped at a packet boundary too, at the
+ * rate it was designed for, so a packet is filtered all the same way. The sampling task never designs nor logs anything.
+ * Q31 (the default) takes any 16-bit samples; Q15 is cheaper, for signals within the int16 range.
+*/
+template <class Sample, class Filter, uint16_t NPACKET, uint16_t OVERLAY, class Cascade = BiquadCascadeQ31<SIGNAL_BIQUADS_MAX>,
+          uint16_t NPACKET_MAX = 2 * NPACKET, uint32_t RING = ringSizeFor(4 * NPACKET)>
+class SignalStream : public PublishedStream {
+  static_assert(OVERLAY < NPACKET && NPACKET <= NPACKET_MAX, "The overlay must be shorter than the packet");
+  static_assert(RING > NPACKET_MAX, "The ring must hold the packet being published, and some more samples");
+  static_assert(std::is_integral<Sample>::value && sizeof(Sample) == 2, "The remoteunit decodes 16-bit samples");
+
+ public:
+  // Sampling task. `rateMilliHz` is the rate the stream starts at: the one the scheduler paces it at, if it does, and the one its filter chain is designed for
+  void begin(const char* name, uint32_t rateMilliHz = 0) {
+    _name = name;
+    snprintf(_topic, sizeof(_topic), "%s%s", topicPrefix, name);
+    _rate = rateMilliHz;
+    _targetRate = rateMilliHz;
+    restart();
+  }
+
+  // Sampling task, after begin(): lets requested rates drive the scheduler channel the sampling task waits on (-1 --> the
+  // sensor paces itself), then publishes the stream. The config handler only finds it from then on, pacing included
+  void pacedBy(int8_t schedulerChannel) {
+    _channel = schedulerChannel;
+    streamPublisher.add(this);
+  }
+
+  template <class T>
+  void push(T x) {
+    enqueue(static_cast<Sample>(_cascade.process(_filter.process(x))));
+  }
+
+  // Sampling task: pushes a whole burst. The filter runs over the block first, in place: `x` holds the filtered samples afterwards
+  template <class T>
+  void push(T* x, uint16_t n) {
+    _filter.process(x, n);
+    _cascade.process(x, n);
+    for (uint16_t i = 0; i < n; i++) enqueue(static_cast<Sample>(x[i]));
+  }
+
+  // Sampling task, for a sensor which paces itself: its samples come at `rateMilliHz` from the next one on. The packet in
+  // progress is dropped, as in restart(). On a new rate, the filter chain is left out until the config handler has
+  // designed it again for it (see followRate())
+  void setRate(uint32_t rateMilliHz) {
+    if (rateMilliHz != _rate) {
+      _rate = rateMilliHz;
+      _cascade.setSections(nullptr, 0);
+      _declaredRate.store(rateMilliHz, std::memory_order_release);
+    }
+    restart();
+  }
+
+  // Sampling task: drops the packet in progress, from the next pushed sample on (the filter history is kept)
+  void restart() {
+    mark(0);
+    _untilBoundary = _npacket;
+  }
+
+  // Config handler. A new rate comes with the filter chain designed again for it
+  bool requestConfig(uint32_t rateMilliHz, uint16_t npacket, uint16_t overlay) override {
+    if (npacket == 0 || npacket > NPACKET_MAX || overlay >= npacket) return false;
+    _requestedRate.store(rateMilliHz, std::memory_order_relaxed);
+    _requestedLayout.store((static_cast<uint32_t>(npacket) << 16) | overlay, std::memory_order_relaxed);
+    if (_channel >= 0 && rateMilliHz != 0 && rateMilliHz != _targetRate) {
+      _targetRate = rateMilliHz;
+      if (_filters.count) offerChain(_filters); // The corners are in Hz: the coefficients follow the rate
+    }
+    _configRequests.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+
+  // Config handler: designs the chain for the rate last asked for, and hands it over
+  bool requestFilters(const FilterSpec& spec) override {
+    if (spec.count > SIGNAL_BIQUADS_MAX) return false;
+    for (uint8_t s = 0; s < spec.count; s++)
+      if (!(spec.sections[s].f0 > 0)) return false;
+    if (!offerChain(spec)) return false;
+    _filters = spec;
+    _configRequests.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+
+  bool isPaced() override { return _channel >= 0; }
+
+  // Config handler
+  void followRate() override {
+    const uint32_t rate = _declaredRate.load(std::memory_order_acquire);
+    if (rate == 0 || rate == _targetRate) return;
+    _targetRate = rate;
+    if (_filters.count && offerChain(_filters)) _configRequests.fetch_add(1, std::memory_order_release);
+  }
+
+  // Publisher task
+  bool publishPending() override {
+    while (true) {
+      /* The ring is looked at before the markers: the sampling task leaves a marker before pushing anything past it,
+       * so every marker up to `head` is visible by now.
+      */
+      const uint32_t head = _ring.writeIndex();
+      const uint32_t end = _start + _pubNpacket;
+      const bool marked = _marksServed.load(std::memory_order_relaxed) != _marks.load(std::memory_order_acquire);
+      const uint32_t markAt = _markAt.load(std::memory_order_relaxed);
+
+      if (_sent) { // Where the next packet starts is only known with the sample after the last one, or a marker right there
+        if (marked && markAt == end) _start = end - takeMarker(); // New layout: as many samples carried over as the sampling task decided
+        else if (head != end) _start = end - _pubOverlay;
+        else return true;
+        _sent = false;
+        _ring.release(_start);
+        continue;
+      }
+
+      if (marked && static_cast<int32_t>(head - markAt) >= 0 && markAt - _start < _pubNpacket) { // The sampling task restarted: the packet in progress is dropped
+        _start = markAt - takeMarker();
+        _ring.release(_start);
+        continue;
+      }
+
+      if (head - _start < _pubNpacket) return true; // The packet in progress isn't full yet
+
+      /* Per library docs, espMqttClient::publish(...) copies the payload
+       * --> the window can be handed back to the sampling task as soon as the call returns.
+      */
+      if (!mqttClient.publish(_topic, 2, false, reinterpret_cast<const uint8_t*>(_ring.window(_start)), _pubNpacket * sizeof(Sample))) return false;
+      _sent = true;
+    }
+  }
+
+  uint32_t getOverruns() override { return _overruns.load(std::memory_order_relaxed); }
+  const char* getTopic() override { return _topic; }
+  const char* getName() override { return _name; }
+
+ private:
+  const char* _name = "";
+  char _topic[24];
+  Filter _filter;
+  Cascade _cascade;
+  SPSCRing<Sample, RING, NPACKET_MAX> _ring; // Mirrored over NPACKET_MAX samples: every packet is a contiguous window
+  std::atomic<uint32_t> _overruns{0};
+
+  // Layout markers, from the sampling task to the publisher: at ring index `_markAt`, switch to the marked layout
+  std::atomic<uint32_t> _markAt{0};
+  std::atomic<uint32_t> _markLayout{0}; // npacket << 16 | overlay
+  std::atomic<uint16_t> _markKeep{0};   // Samples of the last packet carried over into the first one of the new layout
+  std::atomic<uint32_t> _markRate{0};   // [mHz] Only for the log
+  std::atomic<uint32_t> _marks{0};       // Bumped by the sampling task at every marker
+  std::atomic<uint32_t> _marksServed{0}; // Bumped by the publisher when it gets there
+
+  // Config requests, from the config handler to the sampling task
+  std::atomic<uint32_t> _requestedRate{0};
+  std::atomic<uint32_t> _requestedLayout{(static_cast<uint32_t>(NPACKET) << 16) | OVERLAY}; // Kept as it is by requests of filters only
+  std::atomic<uint32_t> _configRequests{0};
+  BiquadChain _requestedChain = {};
+  std::atomic<uint32_t> _filterSeq{0}; // Even, and bumped by 2 at every chain handed over
+  std::atomic<uint32_t> _declaredRate{0}; // [mHz] Set by setRate(), 0 --> never
+
+  // Owned by the config handler
+  uint32_t _targetRate = 0; // [mHz] The rate last asked for: the one chains are designed for
+  FilterSpec _filters = {}; // The chain last asked for, designed again at every new rate
+
+  // Owned by the sampling task
+  uint16_t _npacket = NPACKET;
+  uint16_t _overlay = OVERLAY;
+  uint16_t _untilBoundary = NPACKET; // Pushes left to complete the packet in progress
+  uint32_t _rate = 0; // [mHz]
+  int8_t _channel = -1; // Scheduler channel pacing the sampling task, -1 if the sensor paces itself. Set before the stream is published
+  uint32_t _configsServed = 0;
+  uint32_t _filtersServed = 0; // _filterSeq of the last chain taken
+
+  // Owned by the publisher task
+  uint32_t _start = 0; // Ring index of the first sample of the packet in progress
+  bool _sent = false; // The full packet went out, and the next one hasn't started yet
+  uint16_t _pubNpacket = NPACKET;
+  uint16_t _pubOverlay = OVERLAY;
+  uint32_t _pubRate = 0; // [mHz]
+
+  // Sampling task: hands a filtered sample to the publisher
+  void enqueue(Sample x) {
+    if (!_ring.push(x)) {
+      _overruns.store(_overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return; // The publisher won't see this sample: it doesn't count towards the packet
+    }
+
+    if (--_untilBoundary > 0) return;
+    _untilBoundary = _npacket - _overlay; // A packet is complete: the next one starts with the overlay
+    if (_configRequests.load(std::memory_order_acquire) != _configsServed) applyConfig();
+  }
+
+  // Sampling task: leaves a marker for the publisher at the current ring position, with the current layout
+  void mark(uint16_t keep) {
+    _markAt.store(_ring.writeIndex(), std::memory_order_relaxed);
+    _markLayout.store((static_cast<uint32_t>(_npacket) << 16) | _overlay, std::memory_order_relaxed);
+    _markKeep.store(keep, std::memory_order_relaxed);
+    _markRate.store(_rate, std::memory_order_relaxed);
+    _marks.fetch_add(1, std::memory_order_release);
+  }
+
+  // Sampling task, at a packet boundary
+  void applyConfig() {
+    takeFilters(); // The publisher has no part in it: no need to wait for its marker
+
+    // One marker at a time: a boundary marker overwritten before the publisher gets there would leave the two sides out of step
+    if (_marksServed.load(std::memory_order_acquire) != _marks.load(std::memory_order_relaxed)) return;
+
+    const uint32_t requests = _configRequests.load(std::memory_order_acquire);
+    const uint32_t layout = _requestedLayout.load(std::memory_order_relaxed);
+    const uint32_t rate = _requestedRate.load(std::memory_order_relaxed);
+    _configsServed = requests;
+
+    const uint16_t npacket = layout >> 16;
+    const uint16_t overlay = layout & 0xFFFF;
+    const bool rateChanges = (_channel >= 0 && rate != 0 && rate != _rate);
+    if (npacket == _npacket && overlay == _overlay && !rateChanges) return;
+
+    // The overlay carries over from the last packet, unless it was taken at another rate
+    const uint16_t keep = rateChanges ? 0 : ((overlay < _npacket) ? overlay : _npacket);
+    _npacket = npacket;
+    _overlay = overlay;
+    if (rateChanges) {
+      _rate = rate;
+      acquisitionScheduler.setTaskRate(_channel, rate);
+      takeFilters(); // The chain designed for the new rate, handed over along with it
+    }
+    mark(keep);
+    _untilBoundary = _npacket - keep;
+  }
+
+  // Sampling task: swaps the chain handed over into the cascade, if there's a new one, designed for the current rate,
+  // and it isn't being written right now. A chain for a rate still to come waits for it
+  void takeFilters() {
+    const uint32_t seq = _filterSeq.load(std::memory_order_acquire);
+    if (seq == _filtersServed || (seq & 1)) return; // Odd: the writer bumps the requests once done, so it's retried
+    const BiquadChain chain = _requestedChain;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (_filterSeq.load(std::memory_order_relaxed) != seq) return; // Overwritten while copying: the writer bumps the requests afterwards, so it's retried
+    if (chain.count && chain.rate != _rate) return;
+    _cascade.setSections(chain.sections, chain.count);
+    _filtersServed = seq;
+  }
+
+  // Config handler: designs `spec` for the rate last asked for, and copies it under a sequence count (the sampling task
+  // retries at the next boundary if it catches a copy in progress). false if it can't be designed: nothing is handed over
+  bool offerChain(const FilterSpec& spec) {
+    if (spec.count && _targetRate == 0) {
+      Serial.printf("[%s] ERROR: Unknown sample rate: can't design the filter chain.\n", _name);
+      return false;
+    }
+    const double fs = _targetRate / 1000.0;
+    BiquadChain chain;
+    for (uint8_t s = 0; s < spec.count; s++) {
+      const FilterSpec::Section& section = spec.sections[s];
+      if (section.f0 >= fs / 2) {
+        Serial.printf("[%s] ERROR: Filter section %u at %.2f Hz is past the Nyquist frequency (%.2f Hz). Keeping the chain as it was.\n", _name, s, section.f0, fs / 2);
+        return false;
+      }
+      const double q = (section.q > 0) ? section.q : (section.type == BIQUAD_NOTCH) ? BIQUAD_Q_NOTCH : BIQUAD_Q_BUTTERWORTH;
+      chain.sections[s] = designBiquad(section.type, fs, section.f0, q);
+    }
+    chain.count = spec.count;
+    chain.rate = _targetRate;
+
+    const uint32_t seq = _filterSeq.load(std::memory_order_relaxed);
+    _filterSeq.store(seq + 1, std::memory_order_relaxed); // Odd: copy in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    _requestedChain = chain;
+    _filterSeq.store(seq + 2, std::memory_order_release);
+    Serial.printf("[%s] Filter chain: %u biquad sections, at %.3f Hz, from the next packet on.\n", _name, chain.count, fs);
+    return true;
+  }
+
+  // Publisher task: switches to the marked layout. Returns how many samples of the last packet carry over
+  uint16_t takeMarker() {
+    const uint32_t marks = _marks.load(std::memory_order_acquire);
+    const uint32_t layout = _markLayout.load(std::memory_order_relaxed);
+    const uint16_t keep = _markKeep.load(std::memory_order_relaxed);
+    const uint32_t rate = _markRate.load(std::memory_order_relaxed);
+    if ((layout >> 16) != _pubNpacket || (layout & 0xFFFF) != _pubOverlay || rate != _pubRate) // Restarts keep it all
+      Serial.printf("[%s] Now %u samples per packet, %u overlayed, at %.3f Hz.\n", _name, layout >> 16, layout & 0xFFFF, rate / 1000.0);
+    _pubNpacket = layout >> 16;
+    _pubOverlay = layout & 0xFFFF;
+    _pubRate = rate;
+    _marksServed.store(marks, std::memory_order_release);
+    return keep;
+  }
+};
+
+// ## Sampling task ##
+template <class Sensor>
+void vTask_Sample(void *pvParameters) {
+  static Sensor sensor; // Statically allocated: buffers and filter histories don't weigh on the task stack, nor on the heap
+
+  if (!sensor.begin()) {
+    Serial.printf("[%s] [ERROR] Sensor setup failed. Quitting the sampling task.\n", Sensor::NAME);
+    vTaskDelete(NULL);
+  }
+
+  int8_t channel = -1;
+  if constexpr (Sensor::RATE > 0) {
+    channel = acquisitionScheduler.addTask(Sensor::RATE); // Exact rate, in phase with the other signals
+    Serial.printf("[%s] A sample will be acquired at %.3f Hz.\n", Sensor::NAME, Sensor::RATE / 1000.0);
+  }
+  sensor.pacedBy(channel); // Publishes the streams, now that their pacing is known
+
+  static TaskTiming timing; // Empty in release builds
+  timing.begin(Sensor::NAME);
+
+  while (true) {
+    uint32_t pendingSamples;
+    if constexpr (Sensor::RATE > 0) pendingSamples = acquisitionScheduler.waitForSample();
+    else pendingSamples = sensor.wait();
+    timing.wokeUp(pendingSamples, channel);
+
+    sensor.sample(pendingSamples);
+    timing.done();
+  }
+}
+
+// ## Cooperative executor ##
+/* Low-rate sensors don't need a task each: vTask_SampleJobs<Jobs...> runs them all as jobs of a single task, with one
+ * stack and one stream of context switches between them. A job policy is a class which provides:
+ *   static constexpr const char* NAME;   // Tag for the Serial log
+ *   static const uint32_t RATE;          // [mHz] Boot-time rate on the shared timebase. Jobs are always timer-paced
+ *   bool begin();                        // Sets up the sensor and its streams, from the task. false --> the job is left out
+ *   void pacedBy(int8_t channel);        // Hands the scheduler channel to the streams whose rate may change live: that's when they're published
+ *   uint32_t start();                    // Starts a conversion, without waiting for it. Returns how long [us] until complete() may be called
+ *   bool complete();                     // Carries on the conversion. true --> done, the sample was pushed. false --> call again shortly
+ * A job is a state machine which keeps its state in its own members between steps, so it needs no stack of its own.
+ * It must never block for long: while a step runs, every other job waits.
+*/
+template <class Job>
+class JobRunner {
+  static_assert(Job::RATE > 0, "Jobs are paced by the shared timebase");
+
+ public:
+  // Executor task
+  void begin() {
+    if (!_job.begin()) {
+      Serial.printf("[%s] [ERROR] Sensor setup failed. Leaving the job out.\n", Job::NAME);
+      return;
+    }
+    _channel = acquisitionScheduler.addTask(Job::RATE);
+    _job.pacedBy(_channel);
+    _timing.begin(Job::NAME);
+    Serial.printf("[%s] A sample will be acquired at %.3f Hz, as a job.\n", Job::NAME, Job::RATE / 1000.0);
+  }
+
+  // Executor task: steps the job as far as it can go. Returns how long [us] until it needs a step again, UINT32_MAX --> till it's due
+  uint32_t step() {
+    if (_channel < 0) return UINT32_MAX;
+    while (true) {
+      if (!_converting) {
+        const uint32_t due = acquisitionScheduler.takeDue(_channel);
+        if (!due) return UINT32_MAX;
+        _timing.wokeUp(due, _channel);
+        _readyAt = esp_timer_get_time() + _job.start();
+        _converting = true;
+      }
+
+      const int64_t wait = _readyAt - esp_timer_get_time();
+      if (wait > 0) return wait;
+      if (!_job.complete()) return 0;
+      _timing.done(); // For a job, the execution time spans the whole conversion, from start() to the sample
+      _converting = false;
+    }
+  }
+
+ private:
+  Job _job;
+  TaskTiming _timing;
+  int8_t _channel = -1;
+  bool _converting = false;
+  int64_t _readyAt = 0; // [us] esp_timer time when complete() may be called
+};
+
+template <class... Jobs>
+void vTask_SampleJobs(void *pvParameters) {
+  static std::tuple<JobRunner<Jobs>...> runners; // Statically allocated, as in vTask_Sample
+
+  std::apply([](auto&... runner) { (runner.begin(), ...); }, runners);
+
+  while (true) {
+    uint32_t wait = UINT32_MAX;
+    std::apply([&wait](auto&... runner) { ((wait = std::min(wait, runner.step())), ...); }, runners);
+
+    // Sleep until a job is due (the scheduler notifies this task for all of them), or a conversion is ready
+    ulTaskNotifyTake(pdTRUE, (wait == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS((wait + 999) / 1000));
+  }
+}
+#endif
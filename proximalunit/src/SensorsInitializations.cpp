@@ -1,16 +1,16 @@
 #include <Arduino.h>
 #include <max86150.h>
-#include <Wire.h>
+#include <i2c_arbiter.h>
 
-void initializeMAX86150(MAX86150* sensor) {
+void initializeMAX86150(MAX86150Driver<I2CDevice>* sensor, I2CDevice& bus, const MAX86150Registers& config) {
     Serial.println(F("[MAX86150] Setup of MAX86150 Board (for ECG and PPG)"));
     
-    while (!(sensor -> begin(Wire, I2C_SPEED_FAST))) {
+    while (!(sensor -> begin(bus, I2C_SPEED_FAST))) {
         Serial.println(F("[MAX86150] [ERROR] Board not found. Retrying in 2 seconds..."));
         delay(2000);
     }
     Serial.print(F("[MAX86150] Board found! PartID is: "));
     Serial.println(sensor -> readPartID());
 
-    sensor -> setup();
+    sensor -> setup(config);
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
 #include <max86150.h>
+#include <i2c_arbiter.h>
 
-void initializeMAX86150(MAX86150* sensor);
\ No newline at end of file
+void initializeMAX86150(MAX86150Driver<I2CDevice>* sensor, I2CDevice& bus, const MAX86150Registers& config);
\ No newline at end of file
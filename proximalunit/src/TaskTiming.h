@@ -0,0 +1,181 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <AcquisitionScheduler.h>
+#endif
+
+#ifndef TASK_TIMING
+#define TASK_TIMING 1 // 1 --> the sampling tasks keep timing statistics. The release environment (platformio.ini) sets it to 0: every probe compiles to nothing
+#endif
+#define TASK_TIMING_BUCKETS 24 // Histogram buckets, on powers of 2 [us]: the last one starts at 2^22 us (~4 s)
+#define TASK_TIMING_TASKS_MAX 8 // How many tasks the registry can hold
+
+/* Histogram of durations [us] on fixed log2 buckets: bucket 0 counts 0 us, bucket k counts [2^(k-1), 2^k) us,
+ * and the last bucket everything from 2^(BUCKETS-2) us up. Adding a value is a count-leading-zeros and an increment.
+ * Written by one task only: a reader on another task may see an update half done, which is fine for statistics.
+*/
+class TimingHistogram {
+ public:
+  void add(uint32_t us) {
+    _counts[bucketOf(us)]++;
+    if (us > _max) _max = us;
+  }
+
+  void reset() {
+    for (uint8_t k = 0; k < TASK_TIMING_BUCKETS; k++) _counts[k] = 0;
+    _max = 0;
+  }
+
+  uint32_t count(uint8_t bucket) const { return _counts[bucket]; }
+  uint32_t max() const { return _max; } // [us]
+
+  static uint8_t bucketOf(uint32_t us) {
+    if (us == 0) return 0;
+    const uint8_t k = 32 - __builtin_clz(us);
+    return (k < TASK_TIMING_BUCKETS) ? k : TASK_TIMING_BUCKETS - 1;
+  }
+
+  // Writes the counts as a JSON array, trailing empty buckets left out. Returns the length, as snprintf()
+  int toJson(char* buf, size_t len) const {
+    int8_t last = TASK_TIMING_BUCKETS - 1;
+    while (last >= 0 && _counts[last] == 0) last--;
+    int n = snprintf(buf, len, "[");
+    for (int8_t k = 0; k <= last; k++)
+      n += snprintf(buf + n, (size_t)n < len ? len - n : 0, k ? ",%u" : "%u", (unsigned)_counts[k]);
+    n += snprintf(buf + n, (size_t)n < len ? len - n : 0, "]");
+    return n;
+  }
+
+ private:
+  volatile uint32_t _counts[TASK_TIMING_BUCKETS] = {0};
+  volatile uint32_t _max = 0;
+};
+
+#if defined(ARDUINO) && TASK_TIMING
+class TaskTiming;
+
+/* Registry of the instrumented tasks, for the timing report. Same rules as StreamPublisher: tasks add themselves
+ * one after the other at startup, while a reader may be iterating.
+*/
+class TaskTimingRegistry {
+ public:
+  void add(TaskTiming* timing) {
+    const uint8_t n = _count.load(std::memory_order_relaxed);
+    for (uint8_t i = 0; i < n; i++)
+      if (_tasks[i] == timing) return;
+    if (n >= TASK_TIMING_TASKS_MAX) return;
+    _tasks[n] = timing;
+    _count.store(n + 1, std::memory_order_release);
+  }
+
+  uint8_t count() { return _count.load(std::memory_order_acquire); }
+  TaskTiming* task(uint8_t i) { return _tasks[i]; }
+
+ private:
+  TaskTiming* _tasks[TASK_TIMING_TASKS_MAX] = {nullptr};
+  std::atomic<uint8_t> _count{0};
+};
+
+extern TaskTimingRegistry taskTimings; // Defined in main.cpp
+extern AcquisitionScheduler acquisitionScheduler;
+
+/* Timing probes of a sampling task, taken at every wake-up and at the end of the work it triggered:
+ * - jitter: how late the task woke up after its nominal due time on the shared timebase (timer-paced tasks only)
+ * - exec: time from the wake-up to the end of the work, from the cycle counter
+ * - loop: time between consecutive wake-ups
+ * - deadline misses: due times merged into a later wake-up (the task was still busy or waiting for the CPU),
+ *   plus wake-ups whose work ended past the next due time.
+ * Only the sampling task writes the statistics. reset() is a request, carried out by the task at its next wake-up.
+*/
+class TaskTiming {
+ public:
+  void begin(const char* name) {
+    _name = name;
+    taskTimings.add(this);
+  }
+
+  // Sampling task, right after waking up with `pending` dispatches. `channel`: the scheduler channel pacing it, -1 if the sensor paces itself
+  void wokeUp(uint32_t pending, int8_t channel = -1) {
+    _wakeCycles = ESP.getCycleCount();
+    const int64_t now = esp_timer_get_time();
+
+    if (_resetRequested.load(std::memory_order_acquire)) {
+      jitter.reset();
+      exec.reset();
+      loop.reset();
+      _wakeups = 0;
+      _missed = 0;
+      _overruns = 0;
+      _lastWake = 0;
+      _resetRequested.store(false, std::memory_order_release);
+    }
+
+    if (_lastWake) loop.add(now - _lastWake);
+    _lastWake = now;
+    _wakeups++;
+    if (pending > 1) _missed += pending - 1;
+
+    if (channel >= 0) {
+      _lateness = acquisitionScheduler.lateness(channel);
+      _period = acquisitionScheduler.period(channel);
+      jitter.add(_lateness);
+    } else {
+      _period = 0; // No nominal schedule: no jitter, nor overruns
+    }
+  }
+
+  // Sampling task, once the work of the wake-up is done
+  void done() {
+    const uint32_t us = (ESP.getCycleCount() - _wakeCycles) / getCpuFrequencyMhz();
+    exec.add(us);
+    if (_period && _lateness + us > _period) _overruns++;
+  }
+
+  void reset() { _resetRequested.store(true, std::memory_order_release); }
+
+  // Writes the statistics as a JSON object. Returns the length, as snprintf(): not below `len` --> truncated
+  int toJson(char* buf, size_t len) const {
+    int n = snprintf(buf, len, "{\"task\":\"%s\",\"wakeups\":%u,\"missed\":%u,\"overruns\":%u,\"max_us\":{\"jitter\":%u,\"exec\":%u,\"loop\":%u}",
+                     _name, (unsigned)_wakeups, (unsigned)_missed, (unsigned)_overruns, (unsigned)jitter.max(), (unsigned)exec.max(), (unsigned)loop.max());
+    const TimingHistogram* histograms[] = {&jitter, &exec, &loop};
+    const char* keys[] = {"jitter", "exec", "loop"};
+    for (uint8_t h = 0; h < 3; h++) {
+      n += snprintf(buf + n, (size_t)n < len ? len - n : 0, ",\"%s\":", keys[h]);
+      n += histograms[h]->toJson(buf + n, (size_t)n < len ? len - n : 0);
+    }
+    n += snprintf(buf + n, (size_t)n < len ? len - n : 0, "}");
+    return n;
+  }
+
+  const char* getName() const { return _name; }
+
+  TimingHistogram jitter;
+  TimingHistogram exec;
+  TimingHistogram loop;
+
+ private:
+  const char* _name = "";
+  volatile uint32_t _wakeups = 0;
+  volatile uint32_t _missed = 0;   // Due times merged into a later wake-up
+  volatile uint32_t _overruns = 0; // Wake-ups whose work ended past the next due time
+  std::atomic<bool> _resetRequested{false};
+
+  // Owned by the sampling task, from wokeUp() to done()
+  uint32_t _wakeCycles = 0;
+  int64_t _lastWake = 0; // [us] esp_timer time
+  uint32_t _lateness = 0; // [us]
+  uint32_t _period = 0;   // [us] 0 --> no nominal schedule
+};
+#elif defined(ARDUINO)
+// Release builds: the probes are empty, and calls to them vanish
+class TaskTiming {
+ public:
+  void begin(const char* name) {}
+  void wokeUp(uint32_t pending, int8_t channel = -1) {}
+  void done() {}
+};
+#endif
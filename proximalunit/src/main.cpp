@@ -1,21 +1,57 @@
 #include <map>
-#include <unordered_map>
 #include <cstring>
-#include <string>
 #include <Arduino.h>
 #include <WiFi.h>
 #include <espMqttClientAsync.h>
 #include <ArduinoJson.h>
 #include <max86150.h>
+#include <i2c_arbiter.h>
 #include <protocentral_TLA20xx.h>
 #include <SensorsInitializations.h>
+#include <InterruptLine.h>
+#include <AcquisitionScheduler.h>
+#include <CPULoad.h>
+#include <ArenaAllocator.h>
+#include <Pins.h>
 #include <secrets.h>
-#include <FIR.h>
+#include <SamplingTask.h>
+#include <TaskTiming.h>
+#include <ADCScanner.h>
 
 // ## o-o-o-o SETTINGS o-o-o-o ##
 // ##############################
 // ###  Biosignals Settings  ###
 #define NSIGNALS 4 // How many signals we're acquiring
+#define NSAMPLING_TASKS 2 // The MAX86150 has a task of its own, the other sensors share one as jobs
+#define MAX86150_IRQ_DRIVEN 1 // 1 --> drain the MAX86150 FIFO when its A_FULL interrupt fires. 0 --> poll the sensor once every sampling period
+#define MAX86150_AFULL_FREE_SLOTS 15 // A_FULL fires when only this many (out of 32) FIFO slots are still free, aka after 32-15 = 17 samples
+#define MAX86150_STREAM_RATE 200 // [sps] ECG/PPG rate as streamed to the remoteunit
+#define MAX86150_DECIMATION 1 // The sensor samples this many times faster than MAX86150_STREAM_RATE, and the ESP32 decimates (see "MAX86150 decimators"): 1 (off), 2, 4, or 8 with 50 us LED pulses
+// MAX86150 configuration, checked and turned into register values at compile time
+typedef MAX86150Config<
+  MAX86150_STREAM_RATE * MAX86150_DECIMATION, // ECG sample rate [sps]: 200, 400, 800, 1600, 3200
+  MAX86150_STREAM_RATE * MAX86150_DECIMATION, // PPG sample rate [sps]: must match the ECG one
+  2,     // PPG averaging [samples]
+  100,   // LED pulse width [us]
+  32768, // PPG ADC range [nA]
+  8,     // ECG PGA gain [V/V]
+  95,    // ECG IA gain [V/V * 10]
+  0xFF,  // LED pulse amplitude
+  50,    // LED current range [mA]
+  MAX86150_AFULL_FREE_SLOTS,
+  MAX86150_CHANNELS_PPG_ECG // Channels in the FIFO at boot: the remoteunit can change them with the `MAX86150_CHANNELS` config field
+> MAX86150Settings;
+#define ECG_BAND_LOW 2 // [Hz] ECG filter pass band. The coefficients follow the ECG sample rate above, at compile time
+#define ECG_BAND_HIGH 25 // [Hz]
+#define ECG_FIR_TAPS 31 // Low-pass FIR length: the transition band is about 3.3 * rate / taps wide
+#define ADC_SCAN_RATE 20000 // [Hz] ADC1 conversions per second, shared by the FLOW and TEMP pins: the ESP32 can't scan slower than 20 kHz
+#define ADC_SCAN_POLL_RATE 50 // [Hz] The ADC scanner's DMA pool is drained at least this often, whatever the FLOW and TEMP rates
+#define ADC_SCAN_POOL_BYTES 4096 // DMA pool held by the ADC driver: ~100 ms of conversions at 20 kHz, 5 drains' worth
+#define ECG_DECIMATOR_TAPS 15 // Anti-aliasing FIR length of the last ECG decimation stage, which runs at twice MAX86150_STREAM_RATE
+
+// ###  I2C Settings  ###
+#define I2C_BUS_SPEED I2C_SPEED_FAST // [Hz] Shared by every sensor on the bus
+#define I2C_USAGE_REPORT_PERIOD 10000 // [ms] How often the bus occupancy of each device is printed. 0 --> never
 
 // ###  Wifi Settings  ###
 #define WIFI_IP_SELF IPAddress(10, 42, 0, 171)
@@ -26,6 +62,34 @@
 #define MQTT_BROKER_HOST IPAddress(10, 42, 0, 1)
 #define MQTT_BROKER_PORT 1883
 #define MQTT_TOPIC_CONFIG "cfg"
+#define MQTT_TOPIC_TIMING "timing" // Timing report of the sampling tasks: one JSON message per task (only when built with TASK_TIMING)
+#define MQTT_TOPIC_TIMING_QUERY "timing/get" // Any message here asks for the timing report. Payload `reset` --> the statistics start over after it
+
+// ###  Publisher Settings  ###
+#define PUBLISHER_PERIOD 50 // [ms] How often the publisher task packs the samples waiting in the rings, and publishes the full packets
+#define PUBLISHER_PRIORITY 3 // Below the WiFi and TCP/IP tasks it shares its core with
+#define PUBLISHER_NOTICES 4 // Notices (e.g. dropped samples) the sampling tasks can queue up for the publisher
+
+// ###  Core Placement Settings  ###
+/* The firmware is a two-stage pipeline:
+ *   acquisition: sensor -> sampling task (+ first-stage filtering) -> ring
+ *   network:     ring -> publisher task (packing, encoding) -> MQTT client -> TCP/IP -> WiFi
+ * Each stage runs on its own core, so that packet and network work never steal cycles from the sampling deadlines.
+ * WiFi and the TCP/IP stack already live on PRO_CPU.
+*/
+#define CORE_ACQUISITION APP_CPU_NUM
+#define CORE_NETWORK PRO_CPU_NUM
+#define MQTT_TASK_PRIORITY 1 // The MQTT client's own task, on CORE_NETWORK
+// [ms] How often the load of each core is printed. 0 --> never, and the idle tasks are left alone.
+// Instrumented builds only: the monitor's idle hook keeps both idle tasks spinning instead of sleeping in waiti
+#define CPU_LOAD_REPORT_PERIOD (TASK_TIMING ? 10000 : 0)
+
+// ###  Memory Settings  ###
+#define CONFIG_PAYLOAD_MAX 4096 // [bytes] Config messages longer than this are discarded. The remoteunit's one is under 1 kB
+#define CONFIG_JSON_POOL 6144 // [bytes] Static pool the parsed config message lives in. ArduinoJson reserves slots in blocks of ~2-3 kB
+#define STACK_SAMPLING 2048 // [bytes] Stack of each sampling task
+#define STACK_PUBLISHER 4096 // [bytes]
+#define MEMORY_REPORT_PERIOD 60000 // [ms] How often the heap status is printed. 0 --> only at boot
 
 // ###  Serial Port Settings  ###
 #define SERIAL_BAUDRATE 115200
@@ -38,17 +102,20 @@
 #define IDX_TMP 2 // TeMPerature
 #define IDX_RVL 3 // Respiratory VoLume
 
+// Indexes of the sampling tasks
+#define TASK_ECG 0  // ECG + PPG, from the MAX86150
+#define TASK_JOBS 1 // FLOW, TEMP and GSR, as jobs of the cooperative executor
+
 // MQTT Management stuff
-espMqttClientAsync mqttClient; // The actual MQTT Client instance
+espMqttClientAsync mqttClient(MQTT_TASK_PRIORITY, CORE_NETWORK); // The actual MQTT Client instance
 bool needsMQTTreconnection = false;
 uint32_t timeOfLastReconnect = 0;
 uint32_t currentMillis;
-char topicPrefix[10];
+char topicPrefix[10] = "signal/"; // Prepended to the name of every signal: the remoteunit can change it with the `MQTT_TOPIC_PREFIX` config field
 
 // Handling of big/batched MQTT messages
-const size_t maxPayloadSize = 8192; // Payloads with a total size exceeding this number will be discarded.
-uint8_t* payloadBuffer = nullptr;
-size_t payloadBufferSize = 0;
+const size_t maxPayloadSize = CONFIG_PAYLOAD_MAX; // Payloads with a total size exceeding this number will be discarded.
+uint8_t payloadBuffer[CONFIG_PAYLOAD_MAX]; // Chunks of a split payload are put back together here
 size_t payloadBufferIdx = 0;
 
 // Topic-Callback pairing
@@ -60,258 +127,310 @@ struct MatchTopic { // Defines how to resolve an MQTT topic match.
 std::map<const char*, espMqttClientTypes::OnMessageCallback, MatchTopic> topicCallbacks; // This map will store the couples {topicName -> callbackFunc}, allowing messages coming from different topics to be handled indipendently.
 
 // Operative Settings
-JsonDocument settings;
+ArenaAllocator<CONFIG_JSON_POOL> settingsPool;
+JsonDocument settings(&settingsPool);
 
-// FreeRTOS Tasks handles
-TaskHandle_t* taskHandles[NSIGNALS] = {nullptr}; // Stores handles pointing to created RTOS tasks
-const std::unordered_map<std::string, uint8_t> taskHandleIndexes = { // Matches signalName to correct index of the handle to the vTask() which samples that signal.
-  {"ECG", IDX_ECG},
-  {"GSR", IDX_GSR},
-  {"TMP", IDX_TMP}
+// ## Shared I2C bus ##
+/* The MAX86150 and the TLA20xx sit on the same bus, and are sampled by different tasks.
+ * Every access goes through the arbiter: transactions never interleave, and the highest-priority waiting task
+ * (the MAX86150 one) is always served first.
+*/
+WireBus i2cWire(&Wire);
+I2CArbiter i2cArbiter(i2cWire);
+I2CDevice i2cMAX86150(i2cArbiter, "MAX86150");
+I2CDevice i2cTLA20xx(i2cArbiter, "TLA20xx"); // The TLA20xx library talks to Wire by itself: its calls are fenced with I2CDeviceLock. Conversions go through the device
+uint32_t timeOfLastI2CReport = 0;
+
+// ## Acquisition timebase ##
+AcquisitionScheduler acquisitionScheduler; // A single timer wakes up every timer-paced sampling task, at its exact rate
+
+// ## Analog inputs ##
+ADCScanner adcScanner; // FLOW and TEMP, converted in hardware by the ADC1 continuous mode. Owned by the executor task (TASK_JOBS)
+
+// ## Publisher ##
+/* Sampling tasks never touch the network: their samples go into per-signal wait-free rings (see SignalStream),
+ * which a lower-priority publisher task drains into packets and publishes. A WiFi/TCP stall only delays the publisher.
+ * Text notices for the remote unit take the same way, through a queue which the sampling tasks write to without waiting.
+*/
+StreamPublisher streamPublisher;
+TaskHandle_t publisherTaskHandle = nullptr;
+QueueHandle_t noticeQueue = nullptr;
+typedef char Notice[96];
+StaticQueue_t noticeQueueBuffer;
+uint8_t noticeQueueStorage[PUBLISHER_NOTICES * sizeof(Notice)];
+
+#if TASK_TIMING
+// ## Timing statistics ##
+/* Every sampling task keeps jitter, execution and loop time histograms, and counts its deadline misses (see TaskTiming.h).
+ * A message on MQTT_TOPIC_TIMING_QUERY asks for them: the publisher task sends the report, as it sends everything else.
+*/
+TaskTimingRegistry taskTimings;
+std::atomic<uint8_t> timingQuery{0}; // Set by the query handler: 1 --> report, 2 --> report and reset
+char timingReport[1024]; // Static: the publisher stack doesn't have to fit it
+#endif
+
+// ## Core placement ##
+enum PipelineStage : uint8_t {
+  STAGE_ACQUISITION,
+  STAGE_NETWORK
 };
 
-/* ## FIR Filter for ECG ##
- filter designed with
- http://t-filter.appspot.com
+CPULoadMonitor cpuLoad;
+uint32_t timeOfLastCPUReport = 0;
+
+// ## Static memory plan ##
+/* Nothing is allocated from the heap after setup(): task stacks and TCBs, packets, rings and filter histories
+ * are all statically sized from the settings, and the config message is parsed into a static pool.
+ * WiFi, lwIP and the MQTT client keep their own heap usage, which the periodic heap report keeps an eye on.
+*/
+// Stack and TCB of a task
+template <uint32_t STACK_SIZE>
+struct TaskMemory {
+  StackType_t stack[STACK_SIZE / sizeof(StackType_t)];
+  StaticTask_t tcb;
+};
+TaskMemory<STACK_SAMPLING> samplingTaskMemory[NSAMPLING_TASKS];
+TaskMemory<STACK_PUBLISHER> publisherTaskMemory;
+uint32_t timeOfLastMemoryReport = 0;
 
-sampling frequency: 200 Hz
+// FreeRTOS Tasks handles
+TaskHandle_t taskHandles[NSAMPLING_TASKS] = {nullptr}; // Stores handles of the created RTOS tasks
 
-fixed point precision: 16 bits
+// ## Live signal settings ##
+/* Per-signal `fsample`/`npacket`/`overlay`, and optional `filters`, from the `BIOSIGNALS` config field, waiting to be handed to their streams.
+ * The config handler fills the table, loop() hands the entries over: a signal whose sampling task hasn't registered
+ * its stream yet (the retained config message usually arrives first) keeps its entry until it does.
+*/
+struct SignalSettings {
+  char name[12];
+  uint32_t rate; // [mHz]
+  uint16_t npacket;
+  uint16_t overlay;
+  FilterSpec filters;
+  bool hasFilters; // Whether `filters` was given at all: an empty list clears the chain, no list leaves it as it is
+  bool badFilters; // `filters` was given, but malformed
+  bool pending;
+};
+SignalSettings signalSettings[SIGNAL_STREAMS_MAX];
+uint8_t nSignalSettings = 0;
+portMUX_TYPE signalSettingsMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool signalSettingsPending = false;
+uint8_t streamsAtLastApply = 0;
+
+/* ## MAX86150 decimators ##
+ * With MAX86150_DECIMATION > 1 the sensor samples faster than the streams go, and every burst is brought down to
+ * MAX86150_STREAM_RATE before the stream filters, at the sensor's full 18/19 bits:
+ * - ECG: a 3rd order CIC by MAX86150_DECIMATION / 2 (no multiplies, at the FIFO rate), then a FIR by 2 (run at the stream
+ *   rate only), which takes out everything that would alias into the ECG band. The averaging gains SNR, and anti-aliasing
+ *   no longer rests on the sensor's own decimation filter, with no more bytes on the network.
+ * - PPG: the CIC alone, by MAX86150_DECIMATION. The PPG band is a few Hz, far from its nulls.
+*/
+constexpr double MAX86150_FIFO_FS = MAX86150Settings::registers.ecgRate; // [Hz] Before decimation
+constexpr double ECG_FS = MAX86150_FIFO_FS / MAX86150_DECIMATION; // [Hz] After decimation: what the ECG filter and the stream see
+constexpr FIRTaps<int64_t, ECG_DECIMATOR_TAPS> ECG_ANTIALIAS = designFIR<int64_t, ECG_DECIMATOR_TAPS>(2 * ECG_FS, 0, ECG_FS / 2, 16); // 18-bit samples * 2^16 fit easily in 64 bits
+static_assert(3.3 * 2 * ECG_FS / ECG_DECIMATOR_TAPS / 2 < ECG_FS / 2 - ECG_BAND_HIGH, "Too few ECG_DECIMATOR_TAPS: aliases would reach the ECG band");
+typedef std::conditional<(MAX86150_DECIMATION > 1),
+  DecimatorChain<CICDecimator<int32_t, 3, MAX86150_DECIMATION / 2>, PolyphaseDecimator<int64_t, ECG_DECIMATOR_TAPS, ECG_ANTIALIAS, 2>>,
+  DecimatorChain<>>::type ECGDecimator;
+typedef CICDecimator<int32_t, 3, MAX86150_DECIMATION> PPGDecimator; // 19 bits + 3 * log2(decimation) fit in 32
+
+/* ## ECG filter ##
+ * Band-pass ECG_BAND_LOW - ECG_BAND_HIGH Hz, designed at compile time for the (decimated) ECG sample rate:
+ * - a Butterworth high-pass biquad takes out the baseline wander. A FIR can't resolve an edge this close to DC
+ *   with a reasonable number of taps (nor with a reasonable delay)
+ * - a windowed-sinc low-pass FIR takes out EMG and mains noise, with a linear phase
+*/
+static_assert(ECG_BAND_HIGH < ECG_FS / 2, "The ECG band must lie below half the ECG sample rate");
+static_assert(3.3 * ECG_FS / ECG_FIR_TAPS < ECG_FS / 2 - ECG_BAND_HIGH, "Too few ECG_FIR_TAPS for the transition band above ECG_BAND_HIGH");
+constexpr BiquadCoeffs ECG_HIGHPASS = designBiquad(BIQUAD_HIGHPASS, ECG_FS, ECG_BAND_LOW, BIQUAD_Q_BUTTERWORTH);
+constexpr FIRTaps<long, ECG_FIR_TAPS> ECG_LOWPASS = designFIR<long, ECG_FIR_TAPS>(ECG_FS, 0, ECG_BAND_HIGH, 14); // 16-bit samples * 2^14 * ~1.2 fits in a long
+
+// Channels the MAX86150 task should stream: written by the config message handler, applied by the task itself (which owns the sensor)
+volatile MAX86150Channels requestedMAX86150Channels = MAX86150Settings::registers.channels;
+
+// ## MAX86150 Interrupt line ##
+GPIOInterruptLine max86150IntLineGPIO(PIN_MAX86150_INT);
+InterruptLine* max86150IntLine = &max86150IntLineGPIO; // Point this to a SimulatedInterruptLine to drive the acquisition without the physical INT pin
+
+/* ISR for the MAX86150 INT line: just wake up the sampling task, which will do the I2C work. */
+void IRAM_ATTR _onMAX86150Interrupt(void* arg) {
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(static_cast<TaskHandle_t>(arg), &higherPriorityTaskWoken);
+  if (higherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
 
-* 0 Hz - 1 Hz
-  gain = 0
-  desired attenuation = -40 dB
-  actual attenuation = n/a
 
-* 2 Hz - 25 Hz
-  gain = 1
-  desired ripple = 10 dB
-  actual ripple = n/a
+/* Hands `msg` to the publisher, to be sent on MQTT_TOPIC_CONFIG. Never blocks: if the queue is full, the notice only goes to Serial. */
+void postNotice(const char* msg) {
+  Serial.println(msg);
+  if (noticeQueue) xQueueSend(noticeQueue, msg, 0);
+}
 
-* 26 Hz - 100 Hz
-  gain = 0
-  desired attenuation = -40 dB
-  actual attenuation = n/a
+// ## Sampling tasks ##
+/* The MAX86150 is sampled by vTask_Sample<Sensor>, the low-rate sensors are jobs of vTask_SampleJobs<Jobs...> (see SamplingTask.h).
+ * The policies below only say how to set up their sensor, and how to turn one wake-up (or one conversion) into samples for their streams.
 */
-long ECG_FIR_coeffs[13] = {
-	-364,
-	-103,
-	-42,
-	60,
-	173,
-	262,
-	295,
-	262,
-	173,
-	60,
-	-42,
-	-103,
-	-364
-};
-FIR<long, 13> ECGfir; // Instantiate a filter object
-
-
-// FreeRTOS Tasks
-void vTask_SampleMAX86150(void *pvParameters) {
-  // Recover settings
-  //JsonObject config = *static_cast<JsonObject *>(pvParameters);
-  const double fsample = 220;//config["fsample"].as<float>();
-  const int overlay = 20;//config["overlay"].as<int>();
-  const int npacket = 200;//config["npacket"].as<int>();
-
-  strcpy(topicPrefix, "signal/");
-
-  // Build full topic names
-  char topicECG[strlen(topicPrefix) + 3];
-  char topicPPGRed[strlen(topicPrefix) + 6];
-  char topicPPGIR[strlen(topicPrefix) + 5];
-  strcpy(topicECG, topicPrefix);
-  strcpy(topicPPGRed, topicPrefix);
-  strcpy(topicPPGIR, topicPrefix);
-  strcpy(&topicECG[strlen(topicPrefix)], "ECG");
-  strcpy(&topicPPGRed[strlen(topicPrefix)], "PPGRed");
-  strcpy(&topicPPGIR[strlen(topicPrefix)], "PPGIR");
-  
-  // Initialize sensor
-  MAX86150* max86150 = new MAX86150();
-  initializeMAX86150(max86150);
-
-  // Check that we have everything we need
-  const bool dataOk = (fsample && overlay && npacket);
-  if (!dataOk) { Serial.print(F("[ERROR] Uncastable settings for ECG")); }
-
-  // Prepare array to hold the samples
-  Serial.print(F("[ECG] Creating samples arrays..."));
-  static int16_t* samplesECG;
-  static uint16_t* samplesIR;
-  static uint16_t* samplesRED;
-  samplesECG = static_cast<int16_t*>(pvPortMalloc(npacket * sizeof(int16_t)));
-  samplesIR = static_cast<uint16_t*>(pvPortMalloc(npacket * sizeof(uint16_t)));
-  samplesRED = static_cast<uint16_t*>(pvPortMalloc(npacket * sizeof(uint16_t)));
-  int sampleIndex = 0;
-  Serial.println(" done!");
-
-  // Setup the FIR filter
-  ECGfir.setFilterCoeffs(ECG_FIR_coeffs);
-
-  // Prepare timing data
-  const TickType_t samplePeriod = pdMS_TO_TICKS(1000 / fsample); // Convert [Hz] fsample to number of ticks period
-  Serial.printf("[%s] A sample will be acquired every %d ms, aka every %d ticks.\n", "ECG/PPG", pdTICKS_TO_MS(samplePeriod), samplePeriod);
-  BaseType_t xWasDelayed;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  Serial.println("[ECG] Timerdata set.");
-
-  while (dataOk) {
-    xWasDelayed = xTaskDelayUntil(&xLastWakeTime, samplePeriod);
-
-    //Serial.println(F("[ECG] Polling max86150..."));
-    if (max86150->check() > 0) { // check() polls the sensor, and saves all the available samples in the local FIFO.
-      //while (max86150->available()) { // available() checks the local FIFO, and returns (head-tail).
-      /* Note on MAX86150 data!
-        * The data that then sensor outputs is  3-byte-long (24bit),
-        * although the actual useful datum is always either 18 (for ECG) or 19 (for PPG) bits long.
-        * 
-        * The library we're using returns those in `uint32_t` datatype to fit the whole 24bits,
-        * while masking the unused MSBs of each datum to 0.
-        * 
-        * Accepting to lose 2 LSBs of resolution, we can fit the data in 16bits, just by shifting
-        * to the right 2 positions.
-        */
-        //Serial.printf("[ECG] saving data @idx %d...", sampleIndex);
-        samplesECG[sampleIndex] = static_cast<int16_t>(ECGfir.processReading((max86150->getFIFOECG() >> 2))); // Apply the filter to the ECG reading
-        samplesIR[sampleIndex] = static_cast<uint16_t>(max86150->getFIFOIR() >> 2);
-        samplesRED[sampleIndex] = static_cast<uint16_t>(max86150->getFIFORed() >> 2);
-        sampleIndex++;
-        //max86150->nextSample(); // Advance the local FIFO's tail.
-      //}
-
-      //Serial.println(F(" done!"));
-    }
 
-    /*
-    if (xWasDelayed == pdTRUE) {
-      Serial.print("[");
-      Serial.print(F("MAX86150"));
-      Serial.println(F("] ! Sampling was delayed!"));
-    }*/
-
-    //Serial.println(F("[ECG] Checking if packet is ready..."));
-    if (sampleIndex >= npacket) { // A packet is completeley filled and ready to be sent
-      /* Per library docs, espMqttClient::publish(...) should buffer the payload
-       * --> we don't need to worry about overwriting it before it is completely transmitted.
-       * espMqttClient::publish(...) expects the payload to be an `uint8_t`, but we've been storing
-       * samples as `uint16_t`s --> a cast is needed, keeping in mind that now, interpreting
-       * the sample array in this way, we'll have more elements, as 16/8 = 2.
-      */
-      /*Serial.println("[IR] Publishing data!");
-      for (int k=0; k<npacket; k++) {
-        Serial.printf("%d:", samplesIR[k]);
-      }*/
-      mqttClient.publish(topicECG, 2, false, reinterpret_cast<uint8_t*>(samplesECG), npacket * 2);
-      mqttClient.publish(topicPPGRed, 2, false, reinterpret_cast<uint8_t*>(samplesRED), npacket * 2);
-      mqttClient.publish(topicPPGIR, 2, false, reinterpret_cast<uint8_t*>(samplesIR), npacket * 2);
-      Serial.println(F("pub"));
-      
-      // Bring back the overlayed samples
-      sampleIndex = 0;
-      for (uint8_t i = overlay; i > 0; i--) {
-        samplesECG[sampleIndex] = samplesECG[npacket - i];
-        samplesIR[sampleIndex] = samplesIR[npacket - i];
-        samplesRED[sampleIndex] = samplesRED[npacket - i];
-        sampleIndex++;
-      }
-    }
+/* ECG + PPG, from the MAX86150 FIFO. */
+struct MAX86150Sensor {
+  static constexpr const char* NAME = "ECG";
+  static const uint32_t RATE = MAX86150_IRQ_DRIVEN ? 0 : MAX86150Settings::registers.fifoRate * 1000; // [mHz] When IRQ-driven, the sensor paces itself
+
+  /* Note on MAX86150 data!
+   * The data that then sensor outputs is  3-byte-long (24bit),
+   * although the actual useful datum is always either 18 (for ECG) or 19 (for PPG) bits long.
+   *
+   * The library we're using returns those in `uint32_t` datatype to fit the whole 24bits,
+   * while masking the unused MSBs of each PPG datum to 0 and sign-extending the (two's complement) ECG datum.
+   *
+   * Accepting to lose 2 LSBs of resolution, we can fit the data in 16bits, just by shifting
+   * to the right 2 positions.
+   */
+  SignalStream<int16_t, FilterChain<ShiftRight<2>, Biquad<ECG_HIGHPASS>, SymmetricFIR<long, ECG_FIR_TAPS, ECG_LOWPASS>>, 200, 20> ecg;
+  SignalStream<uint16_t, ShiftRight<2>, 200, 20> red;
+  SignalStream<uint16_t, ShiftRight<2>, 200, 20> ir;
+
+  ECGDecimator ecgDecimator;
+  PPGDecimator redDecimator;
+  PPGDecimator irDecimator;
+
+  MAX86150Driver<I2CDevice> max86150;
+  int32_t burstECG[MAX86150_FIFO_DEPTH]; // Landing arrays for each burst drained from the sensor
+  uint32_t burstIR[MAX86150_FIFO_DEPTH];
+  uint32_t burstRED[MAX86150_FIFO_DEPTH];
+  uint32_t burstTime[MAX86150_FIFO_DEPTH]; // [us] When the sensor took each sample of the burst
+  uint32_t reportedDrops = 0; // Samples lost so far, as last reported to the remote unit
+#if MAX86150_IRQ_DRIVEN
+  static const uint8_t burstLength = 32 - MAX86150_AFULL_FREE_SLOTS;
+  TickType_t irqTimeout;
+#endif
+
+  bool begin() {
+    // The sample rate is set by the sensor registers: the streams are never paced by the scheduler, and ignore requested rates.
+    // They're told the rate anyway, to design their filter chains for it
+    ecg.begin("ECG", MAX86150Settings::registers.fifoRate * 1000 / MAX86150_DECIMATION);
+    red.begin("PPGRed", MAX86150Settings::registers.fifoRate * 1000 / MAX86150_DECIMATION);
+    ir.begin("PPGIR", MAX86150Settings::registers.fifoRate * 1000 / MAX86150_DECIMATION);
+    initializeMAX86150(&max86150, i2cMAX86150, MAX86150Settings::registers);
+    if (MAX86150_DECIMATION > 1)
+      Serial.printf("[ECG] Sampling at %u sps, decimated by %u to %u sps.\n", MAX86150Settings::registers.fifoRate, MAX86150_DECIMATION, MAX86150Settings::registers.fifoRate / MAX86150_DECIMATION);
+
+#if MAX86150_IRQ_DRIVEN
+    /* The sensor paces itself with its own internal clock: let its FIFO fill up to the A_FULL threshold,
+     * then get woken up by the INT line and drain the whole burst at once.
+     * If an edge ever gets lost, the timeout makes us drain the FIFO anyway.
+    */
+    irqTimeout = pdMS_TO_TICKS(2 * 1000 * burstLength / max86150.getFIFORate());
+    Serial.printf("[%s] FIFO will be drained every %d samples, on A_FULL interrupt.\n", "ECG/PPG", burstLength);
+    max86150.enableAFULL(); // The threshold is set by MAX86150Settings
+    max86150IntLine->attach(_onMAX86150Interrupt, xTaskGetCurrentTaskHandle());
+    max86150.getINT1(); // Reading the Interrupt Status register clears anything pending since setup
+    Serial.println("[ECG] Interrupt set.");
+#endif
+    return true;
+  }
 
+  // Even in polled mode, the FIFO rate comes from the sensor registers: the streams are published as self-paced
+  void pacedBy(int8_t channel) {
+    ecg.pacedBy(-1);
+    red.pacedBy(-1);
+    ir.pacedBy(-1);
   }
 
-  // TODO: !!! ensure this is run also on task deletion !!!
-  vPortFree(samplesECG);
-  vPortFree(samplesIR);
-  vPortFree(samplesRED);
-}
+#if MAX86150_IRQ_DRIVEN
+  uint32_t wait() {
+    const uint32_t pending = ulTaskNotifyTake(pdTRUE, irqTimeout);
+    if (!pending) Serial.println(F("[ECG] ! A_FULL interrupt timed out, draining the FIFO anyway."));
+    return pending;
+  }
+#endif
 
-void vTask_SampleFlowmeter(void *pvParameters) {
-  const double Tsample = 10; // [ms]
-  const int overlay = 20;
-  const int npacket = 200;
-  const uint8_t FLOWSENS_PIN = 35;
-  const uint8_t FILTER_NSAMPLES = 80;
-
-  strcpy(topicPrefix, "signal/");
-  // Build full topic name
-  char topicFLOW[strlen(topicPrefix) + 4];
-  strcpy(topicFLOW, topicPrefix);
-  strcpy(&topicFLOW[strlen(topicPrefix)], "FLOW");
-  
-  // Initialize sensor
-  pinMode(FLOWSENS_PIN, INPUT);
-
-  // Check that we have everything we need
-  const bool dataOk = (Tsample && overlay && npacket);
-  if (!dataOk) { Serial.print(F("[ERROR] Uncastable settings for FLOW")); }
-
-  // Prepare array to hold the samples
-  Serial.print(F("[FLOW] Creating samples arrays..."));
-  static long* samplesFLOW;
-  samplesFLOW = static_cast<long*>(pvPortMalloc(npacket * sizeof(long)));
-  long avg;
-  long total = 0;
-  int samples[FILTER_NSAMPLES] = {0};
-  int idx = 0;
-  uint8_t sampleidx = 0;
-  Serial.println(" done!");
-
-  // Prepare timing data
-  const TickType_t samplePeriod = pdMS_TO_TICKS(Tsample); // Convert [Hz] fsample to number of ticks period
-  Serial.printf("[%s] A sample will be acquired every %d ms, aka every %d ticks.\n", "FLOW", pdTICKS_TO_MS(samplePeriod), samplePeriod);
-  BaseType_t xWasDelayed;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  Serial.println("[FLOW] Timerdata set.");
-
-  while (dataOk) {
-    xWasDelayed = xTaskDelayUntil(&xLastWakeTime, samplePeriod);
-
-    // Moving Average filter
-    total = total - samples[idx];
-    samples[idx] = analogRead(FLOWSENS_PIN);
-    total = total + samples[idx];
-    idx += 1;
-    if (idx >= FILTER_NSAMPLES) idx = 0;
-    avg = total / FILTER_NSAMPLES;
-    
-    samplesFLOW[sampleidx] = avg;
-
-    //Serial.println(F("[ECG] Checking if packet is ready..."));
-    if (sampleidx >= npacket) { // A packet is completeley filled and ready to be sent
-      /* Per library docs, espMqttClient::publish(...) should buffer the payload
-       * --> we don't need to worry about overwriting it before it is completely transmitted.
-       * espMqttClient::publish(...) expects the payload to be an `uint8_t`, but we've been storing
-       * samples as `uint16_t`s --> a cast is needed, keeping in mind that now, interpreting
-       * the sample array in this way, we'll have more elements, as 16/8 = 2.
-      */
-      mqttClient.publish(topicFLOW, 2, false, reinterpret_cast<uint8_t*>(samplesFLOW), npacket * 2);
-      //Serial.println(F("pub"));
-      
-      // Bring back the overlayed samples
-      sampleidx = 0;
-      for (uint8_t i = overlay; i > 0; i--) {
-        samplesFLOW[sampleidx] = samplesFLOW[npacket - i];
-        sampleidx++;
-      }
+  void sample(uint32_t pendingSamples) {
+    i2cMAX86150.lock(); // From here to the FIFO burst, the transactions go out back to back, with a single bus hand-over
+#if MAX86150_IRQ_DRIVEN
+    max86150.getINT1(); // Deasserts the INT line, so that the next A_FULL can produce a new edge
+#endif
+
+    /* Apply a channel selection change, if one was requested. Fresh packets are started, as the old ones mix layouts.
+     * The record rate changes with the channels (PPG alone runs at the PPG rate, after averaging): the streams are told,
+     * and so is the remote unit.
+    */
+    const MAX86150Channels channels = requestedMAX86150Channels;
+    if (channels != max86150.getChannels()) {
+      max86150.setChannels(channels);
+      const uint32_t streamRate = max86150.getFIFORate() * 1000 / MAX86150_DECIMATION; // [mHz]
+      ecg.setRate(streamRate);
+      red.setRate(streamRate);
+      ir.setRate(streamRate);
+#if MAX86150_IRQ_DRIVEN
+      irqTimeout = pdMS_TO_TICKS(2 * 1000 * burstLength / max86150.getFIFORate());
+#endif
+      Notice rateMsg;
+      snprintf(rateMsg, sizeof(rateMsg), "[proximalunit] MAX86150 channels set to mode %d: ECG/PPG streams at %.3f Hz",
+               channels, streamRate / 1000.0);
+      postNotice(rateMsg);
+    }
+    const bool hasECG = (channels != MAX86150_CHANNELS_PPG);
+    const bool hasPPG = (channels != MAX86150_CHANNELS_ECG);
+
+    max86150.check(); // check() polls the sensor, and saves all the available samples in the local FIFO.
+    i2cMAX86150.unlock();
+    const uint16_t nburst = max86150.drain(hasECG ? burstECG : nullptr, hasPPG ? burstIR : nullptr, hasPPG ? burstRED : nullptr, MAX86150_FIFO_DEPTH, burstTime); // Move the whole burst out of the local FIFO in one go
+
+    // Let the remote unit know if samples went missing, and from when: lost samples would otherwise go unnoticed
+    const uint32_t drops = max86150.getDroppedSamples();
+    if (drops != reportedDrops && nburst > 0) {
+      Notice dropMsg;
+      snprintf(dropMsg, sizeof(dropMsg), "[proximalunit] MAX86150 dropped %u samples before t=%u us (totals: FIFO %u, ring %u)",
+               (unsigned)(drops - reportedDrops), (unsigned)burstTime[0], (unsigned)max86150.getFIFOOverflows(), (unsigned)max86150.getRingOverflows());
+      postNotice(dropMsg);
+      reportedDrops = drops;
     }
 
+    // Bring each channel's burst down to the stream rate, then filter and push it in one go
+    if (hasECG) ecg.push(burstECG, ecgDecimator.decimate(burstECG, nburst));
+    if (hasPPG) {
+      red.push(burstRED, redDecimator.decimate(burstRED, nburst));
+      ir.push(burstIR, irDecimator.decimate(burstIR, nburst));
+    }
   }
+};
 
-  // TODO: !!! ensure this is run also on task deletion !!!
-  vPortFree(samplesFLOW);
-}
+/* Respiratory flow, from an analog flowmeter. Every sample is the mean of the ADC scanner's conversions since the last one:
+ * a block average over the sample period, with no ADC read of its own.
+*/
+struct FlowmeterSensor {
+  static constexpr const char* NAME = "FLOW";
+  static const uint32_t RATE = 100000; // [mHz]
+  static const uint8_t PIN = 35;
+
+  SignalStream<uint16_t, MovingAverage<uint16_t, uint32_t, 80>, 200, 20, BiquadCascadeQ15<SIGNAL_BIQUADS_MAX>> flow; // 12-bit readings: Q15 filter chain
+
+  bool begin() {
+    if (!adcScanner.isScanning(PIN)) return false;
+    flow.begin("FLOW", RATE);
+    return true;
+  }
+
+  void pacedBy(int8_t channel) { flow.pacedBy(channel); }
 
-void vTask_SampleTemperature(void *pvParameters) {
-  const uint16_t Tsample = 1000; // [ms]
-  const int overlay = 5;
-  const int npacket = 20;
-  const uint8_t TEMPSENS_PIN = 32;
-  const uint8_t FILTER_NSAMPLES = 100;
+  uint32_t start() { return 0; }
+
+  bool complete() {
+    uint16_t mean;
+    adcScanner.poll();
+    if (adcScanner.takeAverage(PIN, mean)) flow.push(mean);
+    return true;
+  }
+};
+
+/* Skin temperature, from an analog front-end. Every sample is the mean of the ADC scanner's conversions since the last one:
+ * ADC_SCAN_RATE / 2 of them at 1 Hz, in place of a burst of blocking reads.
+*/
+struct TemperatureSensor {
+  static constexpr const char* NAME = "TEMP";
+  static const uint32_t RATE = 1000; // [mHz]
+  static const uint8_t PIN = 32;
 
   // Conversion
   /*
@@ -330,44 +449,24 @@ void vTask_SampleTemperature(void *pvParameters) {
   float G=14.53;
   */
 
-  strcpy(topicPrefix, "signal/");
-  // Build full topic name
-  char topicTEMP[strlen(topicPrefix) + 4];
-  strcpy(topicTEMP, topicPrefix);
-  strcpy(&topicTEMP[strlen(topicPrefix)], "TEMP");
-  
-  // Initialize sensor
-  pinMode(TEMPSENS_PIN, INPUT);
-
-  // Check that we have everything we need
-  const bool dataOk = (Tsample && overlay && npacket);
-  if (!dataOk) { Serial.print(F("[ERROR] Uncastable settings for TEMP")); }
-
-  // Prepare array to hold the samples
-  Serial.print(F("[TEMP] Creating samples arrays..."));
-  static float* samplesTEMP;
-  samplesTEMP = static_cast<float*>(pvPortMalloc(npacket * sizeof(float)));
-  long total = 0;
-  int i = 0;
-  uint8_t sampleidx = 0;
-  Serial.println(" done!");
-
-  // Prepare timing data
-  const TickType_t samplePeriod = pdMS_TO_TICKS(Tsample); // Convert [Hz] fsample to number of ticks period
-  Serial.printf("[%s] A sample will be acquired every %d ms, aka every %d ticks.\n", "TEMP", pdTICKS_TO_MS(samplePeriod), samplePeriod);
-  BaseType_t xWasDelayed;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  Serial.println("[TEMP] Timerdata set.");
-
-  while (dataOk) {
-    xWasDelayed = xTaskDelayUntil(&xLastWakeTime, samplePeriod);
-
-    // Flat Average
-    total = 0;
-    for (i=0; i<FILTER_NSAMPLES; i++)
-      total += analogRead(TEMPSENS_PIN);
-    
-    samplesTEMP[sampleidx] = total / FILTER_NSAMPLES;
+  SignalStream<uint16_t, NoFilter, 20, 5, BiquadCascadeQ15<SIGNAL_BIQUADS_MAX>> temp;
+
+  bool begin() {
+    if (!adcScanner.isScanning(PIN)) return false;
+    temp.begin("TEMP", RATE);
+    return true;
+  }
+
+  void pacedBy(int8_t channel) { temp.pacedBy(channel); }
+
+  uint32_t start() { return 0; }
+
+  bool complete() {
+    // Flat Average, over the whole sample period
+    uint16_t mean;
+    adcScanner.poll();
+    if (adcScanner.takeAverage(PIN, mean)) temp.push(mean);
+    return true;
 
     /*
     bits = analogRead(ThermistorPin);
@@ -376,114 +475,185 @@ void vTask_SampleTemperature(void *pvParameters) {
 
     Temp=(-a+sqrt((sq(a)-4*(b*(1-Rt/R0)))))/(2*b);
     */
+  }
+};
 
-    //Serial.println(F("[ECG] Checking if packet is ready..."));
-    if (sampleidx >= npacket) { // A packet is completeley filled and ready to be sent
-      /* Per library docs, espMqttClient::publish(...) should buffer the payload
-       * --> we don't need to worry about overwriting it before it is completely transmitted.
-       * espMqttClient::publish(...) expects the payload to be an `uint8_t`, but we've been storing
-       * samples as `uint16_t`s --> a cast is needed, keeping in mind that now, interpreting
-       * the sample array in this way, we'll have more elements, as 16/8 = 2.
-      */
-      mqttClient.publish(topicTEMP, 2, false, reinterpret_cast<uint8_t*>(samplesTEMP), npacket * 2);
-      //Serial.println(F("pub"));
-      
-      // Bring back the overlayed samples
-      sampleidx = 0;
-      for (uint8_t i = overlay; i > 0; i--) {
-        samplesTEMP[sampleidx] = samplesTEMP[npacket - i];
-        sampleidx++;
-      }
+/* Drains the DMA pool of the ADC scanner, so that it never fills up between two FLOW or TEMP samples, whatever their rates.
+ * It comes first in the executor: the scanner is running by the time FLOW and TEMP begin.
+*/
+struct ADCScanJob {
+  static constexpr const char* NAME = "ADC";
+  static const uint32_t RATE = ADC_SCAN_POLL_RATE * 1000; // [mHz]
+
+  uint32_t reportedOverflows = 0;
+
+  bool begin() {
+    static const uint8_t pins[] = {FlowmeterSensor::PIN, TemperatureSensor::PIN};
+    return adcScanner.begin(pins, sizeof(pins), ADC_SCAN_RATE, ADC_SCAN_POOL_BYTES);
+  }
+
+  void pacedBy(int8_t channel) {} // No stream: the rate never changes
+
+  uint32_t start() { return 0; }
+
+  bool complete() {
+    adcScanner.poll();
+    if (adcScanner.getOverflows() != reportedOverflows) {
+      reportedOverflows = adcScanner.getOverflows();
+      Serial.printf("[ADC] ! DMA pool overflowed: conversions were dropped (%u times so far).\n", (unsigned)reportedOverflows);
     }
+    return true;
+  }
+};
+
+/* Galvanic skin response, from the TLA20xx ADC on the shared I2C bus.
+ * The ADC runs single-shot conversions: start() triggers one, and complete() reads it once it's over,
+ * so the bus is only held for the two register accesses.
+*/
+struct GSRSensor {
+  static constexpr const char* NAME = "GSR";
+  static const uint32_t RATE = 10000; // [mHz]
+  static const uint8_t I2C_ADDR = 0x49;
+  static const uint8_t REG_CONVERSION = 0x00;
+  static const uint8_t REG_CONFIG = 0x01;
+  static const uint8_t CONFIG_START = 0x80; // OS bit, in the MSB of the config register: starts a single-shot conversion
+  static const uint32_t CONVERSION_TIME = 8000; // [us] One conversion at 128 SPS, rounded up
+
+  SignalStream<int16_t, MovingAverage<float, float, 10>, 80, 10, BiquadCascadeQ15<SIGNAL_BIQUADS_MAX>> gsr; // [mV]
+  TLA20XX tinyGSR{I2C_ADDR};
+  uint8_t config[2]; // Config register, MSB first, as set up by begin()
+
+  bool begin() {
+    I2CDeviceLock busLock(i2cTLA20xx);
+    tinyGSR.begin();
+    tinyGSR.setMode(TLA20XX::OP_SINGLE);
+    tinyGSR.setDR(TLA20XX::DR_128SPS);
+    tinyGSR.setFSR(TLA20XX::FSR_2_048V);
+    tinyGSR.setMux(TLA20XX::MUX_AIN0_GND); // Set default channel as AIN0 <-> GND
+    if (!i2cTLA20xx.readRegisters(I2C_ADDR, REG_CONFIG, config, sizeof(config))) return false;
+    config[0] |= CONFIG_START;
+    gsr.begin("GSR", RATE);
+    return true;
+  }
+
+  void pacedBy(int8_t channel) { gsr.pacedBy(channel); }
+
+  uint32_t start() {
+    i2cTLA20xx.writeRegisters(I2C_ADDR, REG_CONFIG, config, sizeof(config));
+    return CONVERSION_TIME;
+  }
+
+  bool complete() {
+    uint8_t raw[2];
+    i2cTLA20xx.readRegisters(I2C_ADDR, REG_CONVERSION, raw, sizeof(raw));
+    const int16_t reading = static_cast<int16_t>((raw[0] << 8) | raw[1]) >> 4; // 12-bit result, left-aligned. +/- 2.048 V FSR, 1 LSB = 1 mV
+    gsr.push(static_cast<float>(reading));
+    return true;
+  }
+};
 
+
+#if TASK_TIMING
+/* Publishes the timing statistics of every sampling task on MQTT_TOPIC_TIMING, one message per task. */
+void publishTimingReport(bool reset) {
+  for (uint8_t i = 0; i < taskTimings.count(); i++) {
+    TaskTiming* timing = taskTimings.task(i);
+    if (timing->toJson(timingReport, sizeof(timingReport)) >= (int)sizeof(timingReport)) {
+      Serial.printf("[TIMING] ERROR: The report of %s doesn't fit in %u bytes. Skipping it.\n", timing->getName(), (unsigned)sizeof(timingReport));
+      continue;
+    }
+    mqttClient.publish(MQTT_TOPIC_TIMING, 1, false, timingReport);
+    if (reset) timing->reset();
   }
+}
 
-  // TODO: !!! ensure this is run also on task deletion !!!
-  vPortFree(samplesTEMP);
+/* Handler for messages received on `MQTT_TOPIC_TIMING_QUERY`: the report is left to the publisher task. */
+void _onTimingQuery(const espMqttClientTypes::MessageProperties& props, const char* topic, const uint8_t* payload, size_t chunkSize, size_t index, size_t total) {
+  const bool reset = (chunkSize == 5 && !memcmp(payload, "reset", 5));
+  timingQuery.store(reset ? 2 : 1, std::memory_order_release);
 }
+#endif
 
-void vTask_SampleGSR(void *pvParameters) {
-  #define TLA20XX_I2C_ADDR 0x49
-  const uint16_t Tsample = 100; // [ms]
-  const int overlay = 10;
-  const int npacket = 80;
-  const uint8_t FILTER_NSAMPLES = 10;
-
-  strcpy(topicPrefix, "signal/");
-  // Build full topic name
-  char topicGSR[strlen(topicPrefix) + 3];
-  strcpy(topicGSR, topicPrefix);
-  strcpy(&topicGSR[strlen(topicPrefix)], "GSR");
-  
-  // Initialize sensor
-  TLA20XX tinyGSR(TLA20XX_I2C_ADDR);
-  tinyGSR.begin();
-  tinyGSR.setMode(TLA20XX::OP_CONTINUOUS);
-  tinyGSR.setDR(TLA20XX::DR_128SPS);
-  tinyGSR.setFSR(TLA20XX::FSR_2_048V);
-  tinyGSR.setMux(TLA20XX::MUX_AIN0_GND); // Set default channel as AIN0 <-> GND
-
-  // Check that we have everything we need
-  const bool dataOk = (Tsample && overlay && npacket);
-  if (!dataOk) { Serial.print(F("[ERROR] Uncastable settings for GSR")); }
-
-  // Prepare array to hold the samples
-  Serial.print(F("[GSR] Creating samples arrays..."));
-  static float* samplesGSR;
-  samplesGSR = static_cast<float*>(pvPortMalloc(npacket * sizeof(float)));
-  float total = 0;
-  float reading;
-  float filterSamples[FILTER_NSAMPLES];
-  int filtidx = 0;
-  uint8_t sampleidx = 0;
-  Serial.println(" done!");
-
-  // Prepare timing data
-  const TickType_t samplePeriod = pdMS_TO_TICKS(Tsample); // Convert [Hz] fsample to number of ticks period
-  Serial.printf("[%s] A sample will be acquired every %d ms, aka every %d ticks.\n", "GSR", pdTICKS_TO_MS(samplePeriod), samplePeriod);
-  BaseType_t xWasDelayed;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  Serial.println("[GSR] Timerdata set.");
-
-  while (dataOk) {
-    xWasDelayed = xTaskDelayUntil(&xLastWakeTime, samplePeriod);
-
-    // Moving Average Filter
-    reading = tinyGSR.read_adc(); // +/- 2.048 V FSR, 1 LSB = 1 mV
-    total = total - filterSamples[filtidx];
-    filterSamples[filtidx] = reading;
-    total = total + filterSamples[filtidx];
-
-    filtidx += 1;
-    if (filtidx >= FILTER_NSAMPLES) filtidx = 0;
-
-    samplesGSR[sampleidx] = total / FILTER_NSAMPLES;
-
-    //Serial.println(F("[ECG] Checking if packet is ready..."));
-    if (sampleidx >= npacket) { // A packet is completeley filled and ready to be sent
-      /* Per library docs, espMqttClient::publish(...) should buffer the payload
-       * --> we don't need to worry about overwriting it before it is completely transmitted.
-       * espMqttClient::publish(...) expects the payload to be an `uint8_t`, but we've been storing
-       * samples as `uint16_t`s --> a cast is needed, keeping in mind that now, interpreting
-       * the sample array in this way, we'll have more elements, as 16/8 = 2.
-      */
-      mqttClient.publish(topicGSR, 2, false, reinterpret_cast<uint8_t*>(samplesGSR), npacket * 2);
-      //Serial.println(F("pub"));
-      
-      // Bring back the overlayed samples
-      sampleidx = 0;
-      for (uint8_t i = overlay; i > 0; i--) {
-        samplesGSR[sampleidx] = samplesGSR[npacket - i];
-        sampleidx++;
+/* Packs and publishes the samples of every stream, at a steady pace, along with the queued notices.
+ * A packet that couldn't be published stays at the head of its stream, and is retried at the next round.
+*/
+void vTask_Publish(void *pvParameters) {
+  uint32_t reportedOverruns[SIGNAL_STREAMS_MAX] = {0};
+  Notice notice;
+  TickType_t lastWakeTime = xTaskGetTickCount();
+
+  while (true) {
+    xTaskDelayUntil(&lastWakeTime, pdMS_TO_TICKS(PUBLISHER_PERIOD));
+
+    streamPublisher.publishAll();
+
+    // Let the remote unit know if a ring ran full: it means the network has been stalled for several packets
+    for (uint8_t i = 0; i < streamPublisher.count(); i++) {
+      PublishedStream* stream = streamPublisher.stream(i);
+      const uint32_t overruns = stream->getOverruns();
+      if (overruns != reportedOverruns[i]) {
+        snprintf(notice, sizeof(notice), "[proximalunit] %s: %u samples dropped, the ring was full", stream->getTopic(), (unsigned)(overruns - reportedOverruns[i]));
+        Serial.println(notice);
+        mqttClient.publish(MQTT_TOPIC_CONFIG, 2, false, notice);
+        reportedOverruns[i] = overruns;
       }
     }
 
+    while (xQueueReceive(noticeQueue, notice, 0) == pdTRUE)
+      mqttClient.publish(MQTT_TOPIC_CONFIG, 2, false, notice);
+
+#if TASK_TIMING
+    if (timingQuery.load(std::memory_order_acquire)) publishTimingReport(timingQuery.exchange(0) == 2);
+#endif
   }
+}
+
+/* Creates a task of the given pipeline stage, on the core the placement settings assign to that stage.
+ * Its stack and TCB are `memory`: the task must never be created twice on the same one.
+*/
+template <uint32_t STACK_SIZE>
+TaskHandle_t createPipelineTask(TaskFunction_t task, const char* name, TaskMemory<STACK_SIZE>& memory, UBaseType_t priority, PipelineStage stage) {
+  const BaseType_t core = (stage == STAGE_ACQUISITION) ? CORE_ACQUISITION : CORE_NETWORK;
+  Serial.printf("[MAIN] Starting %s on core %d, priority %u.\n", name, core, (unsigned)priority);
+  return xTaskCreateStaticPinnedToCore(task, name, STACK_SIZE / sizeof(StackType_t), NULL, priority, memory.stack, &memory.tcb, core);
+}
 
-  // TODO: !!! ensure this is run also on task deletion !!!
-  vPortFree(samplesGSR);
+/* Prints the RAM statically reserved by each subsystem, as planned at compile time. */
+void printMemoryPlan() {
+  const size_t sampling = sizeof(MAX86150Sensor) + sizeof(FlowmeterSensor) + sizeof(TemperatureSensor) + sizeof(GSRSensor);
+  const size_t tasks = sizeof(samplingTaskMemory) + sizeof(publisherTaskMemory);
+  const size_t config = sizeof(payloadBuffer) + sizeof(settingsPool);
+  const size_t publisher = sizeof(streamPublisher) + sizeof(noticeQueueBuffer) + sizeof(noticeQueueStorage);
+  const size_t i2c = sizeof(i2cWire) + sizeof(i2cArbiter) + sizeof(i2cMAX86150) + sizeof(i2cTLA20xx);
+
+  Serial.println(F("[MEM] Static memory plan:"));
+  Serial.printf("[MEM]   ECG/PPG sampling (driver, rings, packets, filters): %u B\n", (unsigned)sizeof(MAX86150Sensor));
+  Serial.printf("[MEM]   FLOW/TEMP/GSR sampling: %u B\n", (unsigned)(sampling - sizeof(MAX86150Sensor)));
+  Serial.printf("[MEM]   Task stacks and TCBs: %u B\n", (unsigned)tasks);
+  Serial.printf("[MEM]   Config message (payload + JSON pool): %u B\n", (unsigned)config);
+  Serial.printf("[MEM]   Publisher (registry, notice queue): %u B\n", (unsigned)publisher);
+  Serial.printf("[MEM]   I2C bus: %u B\n", (unsigned)i2c);
+  Serial.printf("[MEM]   Total: %u B\n", (unsigned)(sampling + tasks + config + publisher + i2c));
 }
 
+/* Prints the heap status: a shrinking minimum or largest block over a long session means something leaks or fragments it. */
+void printHeapStatus() {
+  Serial.printf("[MEM] Heap: %u B free (min %u B), largest block %u B\n", ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+}
+
+/* Prints the share of the last reporting period each core spent outside its idle task. */
+void printCPULoad() {
+  Serial.printf("[CPU] PRO_CPU load %.1f%%, APP_CPU load %.1f%%\n", cpuLoad.sample(PRO_CPU_NUM), cpuLoad.sample(APP_CPU_NUM));
+}
+
+/* Prints how much of the last reporting period `device` kept the I2C bus, and how long it had to wait for it. */
+void printI2CUsage(I2CDevice& device) {
+  const I2CBusUsage usage = device.getUsage();
+  device.resetUsage();
+  Serial.printf("[I2C] %s: %u transactions in %u sessions, bus busy %.2f%%, waited %u us (max %u us)\n",
+                device.getName(), (unsigned)usage.transactions, (unsigned)usage.sessions, 100.0 * usage.busyTime / (1000.0 * I2C_USAGE_REPORT_PERIOD),
+                (unsigned)usage.waitTime, (unsigned)usage.maxWaitTime);
+}
 
 void connectToWiFi(const char* ssid, const char* pswd) {
   Serial.printf("[MAIN] Connecting to WiFi... ssid: '%s'. password: '%s'.\n", ssid, pswd);
@@ -535,17 +705,21 @@ void _onMQTTConnect(bool sessionPresent) {
   Serial.print(F("[MQTT] Connected to broker!\n[MQTT] Session present: "));
   Serial.println(sessionPresent);
 
-  //Serial.printf("[MQTT] Subscribing to Configuration channel `%s`...\n", MQTT_TOPIC_CONFIG);
-  //mqttClient.subscribe(MQTT_TOPIC_CONFIG, 2);
+  Serial.printf("[MQTT] Subscribing to Configuration channel `%s`...\n", MQTT_TOPIC_CONFIG);
+  mqttClient.subscribe(MQTT_TOPIC_CONFIG, 2);
+#if TASK_TIMING
+  mqttClient.subscribe(MQTT_TOPIC_TIMING_QUERY, 1);
+#endif
 
   Serial.println(F("[MQTT] Publishing presence message..."));
   mqttClient.publish(MQTT_TOPIC_CONFIG, 2, false, "[proximalunit] Connected!");
 
-  // Create Sampling tasks
-  xTaskCreatePinnedToCore(vTask_SampleMAX86150, "task_ECG", 2048, NULL, 10, taskHandles[IDX_ECG], APP_CPU_NUM);
-  xTaskCreatePinnedToCore(vTask_SampleFlowmeter, "task_FLOW", 2048, NULL, 9, taskHandles[IDX_RVL], APP_CPU_NUM);
-  xTaskCreatePinnedToCore(vTask_SampleFlowmeter, "task_TEMP", 2048, NULL, 4, taskHandles[IDX_TMP], APP_CPU_NUM);
-  xTaskCreatePinnedToCore(vTask_SampleFlowmeter, "task_GSR", 2048, NULL, 8, taskHandles[IDX_GSR], APP_CPU_NUM);
+  // Create Sampling tasks, once: on a reconnection they are still running, and their rings have buffered the samples in the meantime
+  static bool samplingStarted = false;
+  if (samplingStarted) return;
+  samplingStarted = true;
+  taskHandles[TASK_ECG] = createPipelineTask(vTask_Sample<MAX86150Sensor>, "task_ECG", samplingTaskMemory[TASK_ECG], 10, STAGE_ACQUISITION);
+  taskHandles[TASK_JOBS] = createPipelineTask(vTask_SampleJobs<ADCScanJob, FlowmeterSensor, GSRSensor, TemperatureSensor>, "task_JOBS", samplingTaskMemory[TASK_JOBS], 9, STAGE_ACQUISITION);
 }
 
 void _onMQTTDisconnect(espMqttClientTypes::DisconnectReason reason) {
@@ -570,70 +744,93 @@ void _onOversizedMessage(const espMqttClientTypes::MessageProperties& props, con
   Serial.println(F("[MQTT] Got an oversized MQTT message. I can't handle that! :(("));
 }
 
-/*
-void createSamplingTask(const char* signalName, char* taskName, UBaseType_t uxPriority, void* pvParameters, BaseType_t xCoreID) {
-  auto it = taskHandleIndexes.find(signalName);
-  if (it != taskHandleIndexes.end()) { // `signalName` was found in the map (aka I haven't searched for it past the map's own size)
-    TaskHandle_t* taskHandle = taskHandles[it -> second]; // obtain the corresponding taskHandle*
-
-    switch (it -> second) {
-      case IDX_ECG:
-        xTaskCreatePinnedToCore(vTask_SampleMAX86150, taskName, 2048, pvParameters, uxPriority, taskHandle, xCoreID);
-        break;
-      
-      default:
-        Serial.println(F("       . TashHandle INDEX not in switch/case."));
-        Serial.println(F("[ERROR]. Couldn't create sampling task."));
-        break;
-    }
-  } else { // no index was specified for this specific signalName
-    Serial.println(F("       . I don't know where to look for the index of the taskHandle* for this signal"));
-    Serial.println(F("[ERROR]. Couldn't create sampling task."));
+/* Parses a `filters` list: one [type, f0, q] array per biquad section, with type "lowpass", "highpass", "bandpass" or "notch",
+ * f0 its corner (or center) frequency [Hz], and q optional. E.g. [["notch", 50], ["highpass", 0.5], ["lowpass", 40, 0.707]]
+ * Returns false if the list is malformed (anything that isn't a list of such arrays, too).
+*/
+bool parseFilterSpec(const JsonArray list, FilterSpec& spec) {
+  static const struct { const char* name; BiquadType type; } types[] = {
+    {"lowpass", BIQUAD_LOWPASS}, {"highpass", BIQUAD_HIGHPASS}, {"bandpass", BIQUAD_BANDPASS}, {"notch", BIQUAD_NOTCH}};
+  if (list.size() > SIGNAL_BIQUADS_MAX) return false;
+
+  spec.count = 0;
+  for (JsonArray section: list) {
+    const char* typeName = section[0].as<const char*>();
+    if (!typeName || !section[1].is<float>()) return false;
+    uint8_t t = 0;
+    while (t < sizeof(types) / sizeof(types[0]) && strcmp(types[t].name, typeName)) t++;
+    if (t == sizeof(types) / sizeof(types[0])) return false;
+    spec.sections[spec.count++] = {types[t].type, section[1].as<float>(), section[2].is<float>() ? section[2].as<float>() : 0};
   }
+  return true;
 }
-*/
-
-/*
-void applySignalsSettings(const JsonObject signals) {
-  // Delete old tasks
-  // TODO: ensure they have freed their malloc()'ed memory!!
-  for (int i = 0; i < MAX_SIGNALS; i++)
-    if (taskHandles[i])
-      vTaskDelete(taskHandles[i]);
 
-  // Cycle through signals in the settings dict and start the corresponding sampling task for each
+/* Stores the per-signal settings of the `BIOSIGNALS` config field, for loop() to apply.
+ * Each entry is parsed into a local copy first: only the finished struct is copied under the lock, so the other core
+ * never spins on signalSettingsMux while JSON is being walked. Names and nSignalSettings are only written here.
+*/
+void storeSignalsSettings(const JsonObject signals) {
   for (JsonPair pair: signals) { // See the same iterator implemented in `_onCompleteConfigMessage(...)` for details
     const char* signalName = pair.key().c_str();
-    static JsonObject sett = pair.value().as<JsonObject>();
-    sett["signalName"] = signalName; // add field to sett, useful to pass on the signalName to invoked subroutines
-
-    Serial.print(F("[MAIN] Creating freeRTOS task for "));
-    Serial.println(signalName);
-    char* taskName = static_cast<char*>(malloc(sizeof(char) * (strlen(signalName) + 6))); // task_ has 5 chars + 1 for the terminator (NB: strlen() doesn't count the terminator).
-    strcpy(taskName, "task_");
-    strcpy(&taskName[5], signalName); // strcpy() also copies the terminator. We will overwrite it with the first char of `signalName`.
-    const int priority = sett["priority"].as<int>();
+    JsonObject sett = pair.value().as<JsonObject>();
+
+    // Find the signal's entry, or make room for a new one
+    uint8_t i = 0;
+    while (i < nSignalSettings && strcmp(signalSettings[i].name, signalName)) i++;
+    if (i == SIGNAL_STREAMS_MAX || strlen(signalName) >= sizeof(signalSettings[i].name)) continue;
+
+    SignalSettings entry;
+    strcpy(entry.name, signalName);
+    entry.rate = lroundf(sett["fsample"].as<float>() * 1000);
+    entry.npacket = sett["npacket"].as<uint16_t>();
+    entry.overlay = sett["overlay"].as<uint16_t>();
+    entry.hasFilters = !sett["filters"].isNull();
+    entry.badFilters = entry.hasFilters && !parseFilterSpec(sett["filters"].as<JsonArray>(), entry.filters); // Reported by applySignalsSettings(): no printing in here
+    entry.pending = true;
+
+    portENTER_CRITICAL(&signalSettingsMux);
+    signalSettings[i] = entry;
+    if (i == nSignalSettings) nSignalSettings++;
+    portEXIT_CRITICAL(&signalSettingsMux);
+  }
+  signalSettingsPending = true;
+}
 
-    createSamplingTask(signalName, taskName, priority, &sett, APP_CPU_NUM);
+/* Hands the stored signal settings to their streams. Each one switches at its next packet boundary, reusing its own
+ * buffers, while the other signals keep streaming untouched.
+*/
+void applySignalsSettings() {
+  for (uint8_t i = 0; i < nSignalSettings; i++) {
+    portENTER_CRITICAL(&signalSettingsMux);
+    const SignalSettings entry = signalSettings[i];
+    signalSettings[i].pending = false;
+    portEXIT_CRITICAL(&signalSettingsMux);
+    if (!entry.pending) continue;
+
+    PublishedStream* stream = streamPublisher.find(entry.name);
+    if (!stream) { // Not started yet: try again when more streams are registered
+      portENTER_CRITICAL(&signalSettingsMux);
+      signalSettings[i].pending = true;
+      portEXIT_CRITICAL(&signalSettingsMux);
+      continue;
+    }
 
-    free(taskName);
+    // Sensors which pace themselves (the MAX86150) keep their rate: only the packet layout applies
+    if (!stream->requestConfig(stream->isPaced() ? entry.rate : 0, entry.npacket, entry.overlay))
+      Serial.printf("[CFG] ERROR: Invalid settings for `%s` (npacket %u, overlay %u). Ignoring them.\n", entry.name, entry.npacket, entry.overlay);
+    if (entry.hasFilters && (entry.badFilters || !stream->requestFilters(entry.filters)))
+      Serial.printf("[CFG] ERROR: Invalid filter chain for `%s`. Keeping the current one.\n", entry.name);
   }
-    
 }
-*/
 
 /* Final arrival point of messages published to topic `MQTT_TOPIC_CONFIG`.*/
 void _onCompleteConfigMessage(const espMqttClientTypes::MessageProperties& props, const char* topic, const uint8_t* payload, size_t chunkSize, size_t index, size_t total) {
   Serial.println(F("[MQTT] Got Config message from remoteunit: "));
 
-  // Transform the char array to an actual null-terminated c-string
-  char* strval = new char[chunkSize + 1];
-  memcpy(strval, payload, chunkSize);
-  strval[chunkSize] = '\0';
-  Serial.println(strval);
+  Serial.write(payload, chunkSize);
+  Serial.println();
 
-  DeserializationError err = deserializeJson(settings, strval);
-  delete[] strval;
+  DeserializationError err = deserializeJson(settings, payload, chunkSize); // Parses straight from the payload: no null-terminated copy needed
 
   if (err) {
     Serial.print(F("[JSON] ERROR: Deserialization error: "));
@@ -643,20 +840,28 @@ void _onCompleteConfigMessage(const espMqttClientTypes::MessageProperties& props
   }
 
   // Save signals topic prefix
-  strcpy(topicPrefix, settings["MQTT_TOPIC_PREFIX"].as<const char*>());
+  const char* prefix = settings["MQTT_TOPIC_PREFIX"].as<const char*>();
+  if (prefix && strlen(prefix) < sizeof(topicPrefix)) strcpy(topicPrefix, prefix);
+
+  // Channels to be streamed by the MAX86150: "PPG+ECG", "PPG" or "ECG"
+  const char* channels = settings["MAX86150_CHANNELS"].as<const char*>();
+  if (channels) {
+    if (!strcmp(channels, "PPG+ECG")) requestedMAX86150Channels = MAX86150_CHANNELS_PPG_ECG;
+    else if (!strcmp(channels, "PPG")) requestedMAX86150Channels = MAX86150_CHANNELS_PPG;
+    else if (!strcmp(channels, "ECG")) requestedMAX86150Channels = MAX86150_CHANNELS_ECG;
+    else Serial.printf("[JSON] ERROR: Unknown MAX86150_CHANNELS value `%s`. Ignoring it.\n", channels);
+  }
 
-  /*
   JsonObject json = settings.as<JsonObject>(); // Get smart object reference
   for (JsonPair pair: json) { // Look for the `BIOSIGNALS` field, which contains settings for each signal
     /* Each JsonPair contains:
      * JsonPair::key() -> JsonString
      * JsonPair::value() -> JsonVariant
     */
-   /*
     if (!strcmp(pair.key().c_str(), "BIOSIGNALS")) {
-      applySignalsSettings(pair.value().as<JsonObject>());
+      storeSignalsSettings(pair.value().as<JsonObject>());
     }
-  }*/
+  }
 }
 
 /* Handler for messages received on `MQTT_TOPIC_CONFIG`.
@@ -676,32 +881,20 @@ void _onConfigMessage(const espMqttClientTypes::MessageProperties& props, const
     return;
   }
 
-  if (index == 0) { // That's the first chunk of the split payload --> Initialize buffer
-    if (total > payloadBufferSize) { // If this first chunk is bigger than expected, make room for it
-      delete[] payloadBuffer;
-      payloadBufferSize = total;
-      payloadBuffer = new (std::nothrow) uint8_t[payloadBufferSize];
-      if (!payloadBuffer) {
-        Serial.print(F("[ERROR] Payload buffer couldn't be created to handle chunked msg! (Out of memory?)"));
-        return;
-      }
-    }
-    payloadBufferIdx = 0;
+  if (index == 0 && chunkSize == total) { // The payload came in one piece: no need to copy it
+    _onCompleteConfigMessage(props, topic, payload, total, 0, total);
+    return;
   }
 
+  if (index == 0) payloadBufferIdx = 0; // That's the first chunk of the split payload --> Initialize buffer
+  if (payloadBufferIdx + chunkSize > total) return; // Chunks out of order: wait for the next message to start over
+
   // add data and dispatch when done
-  if (payloadBuffer) {
-    memcpy(&payloadBuffer[payloadBufferIdx], payload, chunkSize);
-    payloadBufferIdx += chunkSize;
-    if (payloadBufferIdx == total) {
-      // message is complete here --> let's finally read it as completely assembled
-      _onCompleteConfigMessage(props, topic, payloadBuffer, total, 0, total);
-      
-      // Reset for next time
-      delete[] payloadBuffer;
-      payloadBuffer = nullptr;
-      payloadBufferSize = 0;
-    }
+  memcpy(&payloadBuffer[payloadBufferIdx], payload, chunkSize);
+  payloadBufferIdx += chunkSize;
+  if (payloadBufferIdx == total) {
+    // message is complete here --> let's finally read it as completely assembled
+    _onCompleteConfigMessage(props, topic, payloadBuffer, total, 0, total);
   }
 }
 
@@ -726,6 +919,9 @@ void _onMQTTMessage(const espMqttClientTypes::MessageProperties& props, const ch
 void setup() {
   // Setup topic callbacks
   topicCallbacks.emplace(MQTT_TOPIC_CONFIG, _onConfigMessage); // The callback which will handle incoming messages on topic 'cfg' is _onConfigMessage
+#if TASK_TIMING
+  topicCallbacks.emplace(MQTT_TOPIC_TIMING_QUERY, _onTimingQuery);
+#endif
 
   Serial.begin(SERIAL_BAUDRATE);
   Serial.println(F("[SETUP] Hello! Setup in progress..."));
@@ -744,12 +940,27 @@ void setup() {
   mqttClient.onConnect(_onMQTTConnect);
   mqttClient.onDisconnect(_onMQTTDisconnect);
   mqttClient.onSubscribe(_onMQTTSubscribe);
-  //mqttClient.onMessage(_onMQTTMessage);
+  mqttClient.onMessage(_onMQTTMessage);
   // Settings
   mqttClient.setServer(MQTT_BROKER_HOST, MQTT_BROKER_PORT);
 
+  Serial.println(F("[SETUP] Starting the I2C bus..."));
+  i2cArbiter.begin(I2C_BUS_SPEED);
+
+  Serial.println(F("[SETUP] Starting the acquisition scheduler..."));
+  if (!acquisitionScheduler.begin()) Serial.println(F("[SETUP] ERROR: The acquisition scheduler has no timer: timer-paced sensors won't sample."));
+
+  Serial.println(F("[SETUP] Starting the publisher..."));
+  noticeQueue = xQueueCreateStatic(PUBLISHER_NOTICES, sizeof(Notice), noticeQueueStorage, &noticeQueueBuffer);
+  publisherTaskHandle = createPipelineTask(vTask_Publish, "task_PUB", publisherTaskMemory, PUBLISHER_PRIORITY, STAGE_NETWORK);
+
+  if (CPU_LOAD_REPORT_PERIOD) cpuLoad.begin();
+
   connectToWiFi(WIFI_SSID, WIFI_PSWD);
 
+  printMemoryPlan();
+  printHeapStatus();
+
   Serial.println(F("[SETUP] Done :-)"));
 } // end config()
 
@@ -765,6 +976,33 @@ void loop() {
     }
   }
 
+  // Apply new signal settings, or retry the ones whose stream has just started
+  if (signalSettingsPending || streamPublisher.count() != streamsAtLastApply) {
+    signalSettingsPending = false;
+    streamsAtLastApply = streamPublisher.count();
+    applySignalsSettings();
+  }
+  streamPublisher.followRates(); // Filter chains designed again for self-paced streams whose sensor changed rate
+
+  // Report the I2C bus occupancy of each device
+  if (I2C_USAGE_REPORT_PERIOD && (millis() - timeOfLastI2CReport) > I2C_USAGE_REPORT_PERIOD) {
+    timeOfLastI2CReport = millis();
+    printI2CUsage(i2cMAX86150);
+    printI2CUsage(i2cTLA20xx);
+  }
+
+  // Report the load of each core
+  if (CPU_LOAD_REPORT_PERIOD && (millis() - timeOfLastCPUReport) > CPU_LOAD_REPORT_PERIOD) {
+    timeOfLastCPUReport = millis();
+    printCPULoad();
+  }
+
+  // Report the heap status
+  if (MEMORY_REPORT_PERIOD && (millis() - timeOfLastMemoryReport) > MEMORY_REPORT_PERIOD) {
+    timeOfLastMemoryReport = millis();
+    printHeapStatus();
+  }
+
 
 
 
@@ -0,0 +1,68 @@
+// Parsing of the ADC1 continuous-mode frames (ADCScanSums), on the host (pio test -e native)
+#include <unity.h>
+#include <ADCScanner.h>
+#include <vector>
+
+static const uint8_t PINS[] = {35, 32}; // FLOW, TEMP
+static const uint8_t CHANNELS[] = {7, 4}; // Their ADC1 channels
+
+static ADCScanSums sums;
+
+// A frame as the DMA writes it: 12-bit result, 4-bit channel, little endian
+static void addFrame(std::vector<uint8_t>& frames, uint8_t channel, uint16_t data) {
+  const uint16_t frame = (channel << 12) | data;
+  frames.push_back(frame & 0xFF);
+  frames.push_back(frame >> 8);
+}
+
+void setUp(void) { TEST_ASSERT_TRUE(sums.setPins(PINS, CHANNELS, 2)); }
+void tearDown(void) {}
+
+static void test_frames_go_to_their_pins(void) {
+  std::vector<uint8_t> frames;
+  for (int i = 0; i < 1000; i++) {
+    addFrame(frames, 7, 1000 + i % 2);
+    addFrame(frames, 4, 4095);
+    addFrame(frames, 5, 1234); // No pin on it: skipped
+  }
+  sums.accumulate(frames.data(), frames.size());
+
+  uint16_t mean;
+  TEST_ASSERT_TRUE(sums.takeAverage(35, mean));
+  TEST_ASSERT_EQUAL_UINT16(1001, mean); // 1000.5, rounded
+  TEST_ASSERT_TRUE(sums.takeAverage(32, mean));
+  TEST_ASSERT_EQUAL_UINT16(4095, mean);
+  TEST_ASSERT_FALSE(sums.takeAverage(35, mean)); // Taken: empty until the next frames
+}
+
+// Frames of one pin spread over several reads add up, and a trailing odd byte is not a frame
+static void test_split_reads(void) {
+  std::vector<uint8_t> frames;
+  for (int i = 0; i < 10; i++) addFrame(frames, 4, 100 * i);
+  sums.accumulate(frames.data(), 7); // 3 frames and a half
+  sums.accumulate(frames.data() + 6, frames.size() - 6);
+
+  uint16_t mean;
+  TEST_ASSERT_TRUE(sums.takeAverage(32, mean));
+  TEST_ASSERT_EQUAL_UINT16(450, mean);
+  TEST_ASSERT_FALSE(sums.takeAverage(35, mean));
+}
+
+static void test_pins(void) {
+  uint16_t mean;
+  TEST_ASSERT_TRUE(sums.isScanning(35));
+  TEST_ASSERT_FALSE(sums.isScanning(33));
+  TEST_ASSERT_FALSE(sums.takeAverage(33, mean));
+
+  const uint8_t many[ADC_SCAN_PINS_MAX + 1] = {};
+  TEST_ASSERT_FALSE(sums.setPins(many, many, ADC_SCAN_PINS_MAX + 1));
+  TEST_ASSERT_TRUE(sums.isScanning(35)); // Unchanged
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_frames_go_to_their_pins);
+  RUN_TEST(test_split_reads);
+  RUN_TEST(test_pins);
+  return UNITY_END();
+}
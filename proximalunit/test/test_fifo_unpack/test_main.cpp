@@ -0,0 +1,193 @@
+// Micro-benchmark of the MAX86150 FIFO read-out, on the host (pio test -e native).
+// Both paths drain the same simulated sensor, about 25 PPG + ECG records at a time:
+// - original: FIFO pointers read one by one, FIFO_DATA read in chunks of one 32-byte Wire buffer, then every byte
+//   fetched through a virtual Stream::read() and assembled through a temp array
+// - driver: check(), i.e. one pointer burst, chunks as long as the bus allows, and the block kernel
+// Reported: host CPU time per sample (simulator included, on both sides) and simulated I2C time per sample at 400 kHz.
+#include <unity.h>
+#include <max86150.h>
+#include <max86150_sim.h>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+static const int RECORDS = 25; //Well short of a full FIFO, whose pointers are equal: the original path missed it
+static const uint32_t FILL_TIME = RECORDS * 5000; //[us] at 200 sps. The read-out itself lets a few more records in
+static const int ROUNDS = 2000;
+
+//Positive waveforms: the original path didn't sign-extend ECG values
+static double ramp(double t) { return 1000.0 + 100000.0 * (t - (int)t); }
+
+//Stand-in for TwoWire's receive buffer
+class ByteStream {
+ public:
+  virtual ~ByteStream() {}
+  virtual int read() { return (_offset < _length) ? _buffer[_offset++] : -1; }
+  void fill(SimulatedMAX86150 &sim, uint8_t reg, uint8_t length) {
+    sim.readRegisters(MAX86150_SIM_ADDRESS, reg, _buffer, length);
+    _length = length;
+    _offset = 0;
+  }
+
+ private:
+  uint8_t _buffer[32];
+  uint8_t _length = 0;
+  uint8_t _offset = 0;
+};
+
+//check() before the bulk read and the block kernel, on top of the simulator
+struct OriginalReader {
+  static const int STORAGE_SIZE = 4;
+  uint32_t red[STORAGE_SIZE];
+  uint32_t IR[STORAGE_SIZE];
+  int32_t ecg[STORAGE_SIZE];
+  uint8_t head = 0;
+  ByteStream port;
+
+  int check(SimulatedMAX86150 &sim, uint32_t *irOut = nullptr, uint32_t *redOut = nullptr, int32_t *ecgOut = nullptr) {
+    const int activeDevices = 3;
+    port.fill(sim, 0x06, 1);
+    const uint8_t readPointer = port.read();
+    port.fill(sim, 0x04, 1);
+    const uint8_t writePointer = port.read();
+    if (readPointer == writePointer) return 0;
+
+    int numberOfSamples = writePointer - readPointer;
+    if (numberOfSamples < 0) numberOfSamples += 32;
+    int bytesLeftToRead = numberOfSamples * activeDevices * 3;
+    int n = 0;
+    while (bytesLeftToRead > 0) {
+      int toGet = bytesLeftToRead;
+      if (toGet > 32) toGet = 32 - (32 % (activeDevices * 3));
+      bytesLeftToRead -= toGet;
+      port.fill(sim, 0x07, toGet);
+
+      while (toGet > 0) {
+        head++;
+        head %= STORAGE_SIZE;
+
+        uint8_t temp[sizeof(uint32_t)];
+        uint32_t tempLong;
+
+        temp[3] = 0;
+        temp[2] = port.read();
+        temp[1] = port.read();
+        temp[0] = port.read();
+        memcpy(&tempLong, temp, sizeof(tempLong));
+        tempLong &= 0x7FFFF;
+        IR[head] = tempLong;
+
+        temp[3] = 0;
+        temp[2] = port.read();
+        temp[1] = port.read();
+        temp[0] = port.read();
+        memcpy(&tempLong, temp, sizeof(tempLong));
+        tempLong &= 0x7FFFF;
+        red[head] = tempLong;
+
+        int32_t tempLongSigned;
+        temp[3] = 0;
+        temp[2] = port.read();
+        temp[1] = port.read();
+        temp[0] = port.read();
+        memcpy(&tempLongSigned, temp, sizeof(tempLongSigned));
+        ecg[head] = tempLongSigned;
+
+        if (irOut) { irOut[n] = IR[head]; redOut[n] = red[head]; ecgOut[n] = ecg[head]; }
+        n++;
+        toGet -= activeDevices * 3;
+      }
+    }
+    return n;
+  }
+};
+
+static SimulatedMAX86150 *sim;
+static MAX86150Driver<SimulatedMAX86150> *sensor;
+
+void setUp(void) {
+  sim = new SimulatedMAX86150();
+  sim->setWaveform(MAX86150_SIM_IR, ramp);
+  sim->setWaveform(MAX86150_SIM_RED, ramp);
+  sim->setWaveform(MAX86150_SIM_ECG, ramp);
+  sensor = new MAX86150Driver<SimulatedMAX86150>();
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  sensor->setup(MAX86150Config<>::registers);
+  sensor->check(); //Start from an empty FIFO
+}
+
+void tearDown(void) {
+  delete sensor;
+  delete sim;
+}
+
+static void test_same_samples(void) {
+  SimulatedMAX86150 twin; //Same waveforms, same timeline
+  twin.setWaveform(MAX86150_SIM_IR, ramp);
+  twin.setWaveform(MAX86150_SIM_RED, ramp);
+  twin.setWaveform(MAX86150_SIM_ECG, ramp);
+  MAX86150Driver<SimulatedMAX86150> configurator;
+  configurator.begin(twin, I2C_SPEED_FAST);
+  configurator.setup(MAX86150Config<>::registers);
+  configurator.check();
+  twin.advanceTo(sim->now() + FILL_TIME);
+  sim->advanceTo(twin.now());
+
+  uint32_t irOld[RECORDS], redOld[RECORDS];
+  int32_t ecgOld[RECORDS];
+  OriginalReader original;
+  TEST_ASSERT_EQUAL(RECORDS, original.check(twin, irOld, redOld, ecgOld));
+
+  uint32_t ir[RECORDS], red[RECORDS];
+  int32_t ecg[RECORDS];
+  TEST_ASSERT_EQUAL(RECORDS, sensor->check());
+  TEST_ASSERT_EQUAL(RECORDS, sensor->drain(ecg, ir, red, RECORDS));
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(irOld, ir, RECORDS);
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(redOld, red, RECORDS);
+  TEST_ASSERT_EQUAL_INT32_ARRAY(ecgOld, ecg, RECORDS);
+}
+
+struct Cost {
+  double cpu; //[ns/sample] on the host
+  double bus; //[us/sample] of simulated I2C
+};
+
+template <class F>
+static Cost measure(F readOut) {
+  sim->resetStats();
+  double cpu = 0;
+  double samples = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    sim->advance(FILL_TIME); //Not timed: the sensor filling its FIFO
+    const auto start = std::chrono::steady_clock::now();
+    const int n = readOut();
+    cpu += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_GREATER_OR_EQUAL(RECORDS, n);
+    TEST_ASSERT_LESS_THAN(MAX86150_FIFO_DEPTH, n);
+    samples += n;
+  }
+  return {cpu / samples, sim->getStats().busTime / samples};
+}
+
+static void test_benchmark(void) {
+  OriginalReader original;
+  const Cost before = measure([&] { return original.check(*sim); });
+  const Cost after = measure([&] {
+    const int n = sensor->check();
+    sensor->drain(nullptr, nullptr, nullptr, n);
+    return n;
+  });
+
+  char line[160];
+  snprintf(line, sizeof(line), "FIFO read-out, PPG + ECG: original %.1f ns + %.1f us of bus per sample, driver %.1f ns + %.1f us",
+           before.cpu, before.bus, after.cpu, after.bus);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN(before.bus, after.bus); //Fewer transactions, fewer address phases
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_samples);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
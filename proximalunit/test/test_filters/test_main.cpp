@@ -0,0 +1,198 @@
+// Filter design and fixed-point filter stages, on the host (pio test -e native)
+#include <unity.h>
+#include <Filters.h>
+#include <chrono>
+#include <complex>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// ## The ECG chain of main.cpp at 200 sps: 2 Hz Butterworth high-pass biquad, then a 25 Hz, 31-tap low-pass FIR ##
+constexpr double FS = 200;
+constexpr BiquadCoeffs HIGHPASS = designBiquad(BIQUAD_HIGHPASS, FS, 2, BIQUAD_Q_BUTTERWORTH);
+constexpr FIRTaps<long, 31> LOWPASS = designFIR<long, 31>(FS, 0, 25, 14);
+
+static_assert(isSymmetric(LOWPASS.taps), "designFIR must give symmetric taps");
+static_assert(HIGHPASS.b0 + HIGHPASS.b1 + HIGHPASS.b2 <= 1 && HIGHPASS.b0 + HIGHPASS.b1 + HIGHPASS.b2 >= -1, "A high-pass has a zero at DC (give or take the rounding of its taps)");
+
+// Response of the rounded coefficients at `f` Hz [dB]
+static double responseDB(const BiquadCoeffs& c, double f) {
+  const std::complex<double> z1 = std::polar(1.0, -2 * M_PI * f / FS);
+  const std::complex<double> z2 = z1 * z1;
+  const std::complex<double> h = (double(c.b0) + double(c.b1) * z1 + double(c.b2) * z2) / (std::ldexp(1.0, c.frac) + double(c.a1) * z1 + double(c.a2) * z2);
+  return 20 * log10(std::abs(h));
+}
+
+template <size_t N>
+static double responseDB(const FIRTaps<long, N>& t, double f) {
+  std::complex<double> h = 0;
+  for (size_t n = 0; n < N; n++) h += double(t.taps[n]) * std::polar(1.0, -2 * M_PI * f * n / FS);
+  return 20 * log10(std::abs(h) / std::ldexp(1.0, t.frac));
+}
+
+static double chainDB(double f) { return responseDB(HIGHPASS, f) + responseDB(LOWPASS, f); }
+
+// Steady-state gain of a stage [dB], measured with a sine of amplitude `amp`
+template <class Stage>
+static double measuredDB(double f, double amp) {
+  Stage stage;
+  double peak = 0;
+  for (int i = 0; i < 40 * FS; i++) {
+    const long y = stage.process(lround(amp * sin(2 * M_PI * f * i / FS)));
+    if (i > 30 * FS && fabs(double(y)) > peak) peak = fabs(double(y));
+  }
+  return 20 * log10(peak / amp);
+}
+
+typedef FilterChain<Biquad<HIGHPASS>, SymmetricFIR<long, 31, LOWPASS>> ECGChain;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_ecg_chain_response(void) {
+  TEST_ASSERT_DOUBLE_WITHIN(0.1, -3.0, chainDB(2));   // High-pass corner
+  TEST_ASSERT_DOUBLE_WITHIN(0.5, -12.0, chainDB(1));  // 12 dB/octave below it
+  TEST_ASSERT_DOUBLE_WITHIN(0.2, 0.0, chainDB(10));   // Flat mid-band
+  TEST_ASSERT_DOUBLE_WITHIN(0.2, 0.0, chainDB(15));
+  TEST_ASSERT_DOUBLE_WITHIN(0.5, -6.0, chainDB(25));  // Windowed-sinc edge
+  TEST_ASSERT_LESS_THAN(-50, chainDB(40));
+  TEST_ASSERT_DOUBLE_WITHIN(1.0, -58.0, chainDB(50)); // Mains
+}
+
+// The fixed-point stages follow the response of their coefficients
+static void test_ecg_chain_fixed_point(void) {
+  const double amp = 8000; // An int16 ECG sample, after ShiftRight<2>
+  for (double f : {2.0, 5.0, 10.0, 20.0, 25.0}) TEST_ASSERT_DOUBLE_WITHIN(0.2, chainDB(f), measuredDB<ECGChain>(f, amp));
+  TEST_ASSERT_LESS_THAN(-50, measuredDB<ECGChain>(50, amp));
+}
+
+// SymmetricFIR against a plain convolution over every tap, with the same rounding: bit-exact, per sample and per block
+static void test_symmetric_fir_matches_reference(void) {
+  const int n = 500;
+  int16_t x[n];
+  srand(1);
+  for (int i = 0; i < n; i++) x[i] = static_cast<int16_t>(rand() % 65536 - 32768);
+
+  SymmetricFIR<long, 31, LOWPASS> fir;
+  SymmetricFIR<long, 31, LOWPASS> blockFir;
+  int16_t block[n];
+  for (int i = 0; i < n; i++) block[i] = x[i];
+  for (int i = 0; i < n; i += 17) blockFir.process(&block[i], (n - i < 17) ? n - i : 17); // Bursts of any length
+
+  for (int i = 0; i < n; i++) {
+    long acc = 0;
+    for (int k = 0; k < 31 && k <= i; k++) acc += LOWPASS.taps[k] * x[i - k];
+    const long expected = (acc + (1L << (LOWPASS.frac - 1))) >> LOWPASS.frac;
+    TEST_ASSERT_EQUAL(expected, fir.process(static_cast<long>(x[i])));
+    TEST_ASSERT_EQUAL(static_cast<int16_t>(expected), block[i]);
+  }
+}
+
+// Plain direct-form FIR over every tap, with a shifted delay line: what SymmetricFIR is measured against
+struct DirectFIR {
+  long history[31] = {};
+  long process(long x) {
+    for (int k = 30; k > 0; k--) history[k] = history[k - 1];
+    history[0] = x;
+    long acc = 0;
+    for (int k = 0; k < 31; k++) acc += LOWPASS.taps[k] * history[k];
+    return (acc + (1L << (LOWPASS.frac - 1))) >> LOWPASS.frac;
+  }
+};
+
+// Host time per sample [ns] of `run`, which filters `n` samples
+template <class F>
+static double nsPerSample(F run, int n) {
+  const auto start = std::chrono::steady_clock::now();
+  run();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// The 31-tap ECG low-pass: SymmetricFIR per sample and per block, against the direct form
+static void test_benchmark_symmetric_fir(void) {
+  const int n = 200000;
+  const int BLOCK = 32;
+  static int16_t x[n];
+  srand(2);
+  for (int i = 0; i < n; i++) x[i] = static_cast<int16_t>(rand() % 65536 - 32768);
+
+  long sum = 0; // Keeps the loops from being optimized away
+  DirectFIR direct;
+  const double directNs = nsPerSample([&] { for (int i = 0; i < n; i++) sum += direct.process(x[i]); }, n);
+  SymmetricFIR<long, 31, LOWPASS> fir;
+  const double sampleNs = nsPerSample([&] { for (int i = 0; i < n; i++) sum -= fir.process(static_cast<long>(x[i])); }, n);
+  SymmetricFIR<long, 31, LOWPASS> blockFir;
+  static int16_t block[n];
+  for (int i = 0; i < n; i++) block[i] = x[i];
+  const double blockNs = nsPerSample([&] { for (int i = 0; i < n; i += BLOCK) blockFir.process(&block[i], BLOCK); }, n);
+
+  char line[160];
+  snprintf(line, sizeof(line), "31-tap FIR: direct form %.1f ns/sample, SymmetricFIR %.1f ns per sample, %.1f ns in blocks of %d",
+           directNs, sampleNs, blockNs, BLOCK);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL(0, sum); // Same outputs from both
+}
+
+// ## The ECG decimator of main.cpp with MAX86150_DECIMATION 4: CIC by 2 at 800 sps, then a 15-tap FIR by 2 at 400 sps ##
+constexpr FIRTaps<int64_t, 15> ANTIALIAS = designFIR<int64_t, 15>(2 * FS, 0, FS / 2, 16);
+typedef DecimatorChain<CICDecimator<int32_t, 3, 2>, PolyphaseDecimator<int64_t, 15, ANTIALIAS, 2>> ECGDecimator;
+
+// Output of the decimator for a sine at `f` Hz at the input rate, fed in bursts of `burst` samples
+static std::vector<int32_t> decimateSine(double f, uint16_t burst, double amp = 100000) {
+  ECGDecimator decimator;
+  std::vector<int32_t> out;
+  int32_t buf[32];
+  const int total = 20 * 4 * FS; // 20 s
+  for (int i = 0; i < total;) {
+    uint16_t n = 0;
+    for (; n < burst && i < total; n++, i++) buf[n] = lround(amp * sin(2 * M_PI * f * i / (4 * FS)));
+    const uint16_t m = decimator.decimate(buf, n);
+    out.insert(out.end(), buf, buf + m);
+  }
+  return out;
+}
+
+static double decimatedDB(double f) {
+  const double amp = 100000; // 18-bit ECG samples
+  const std::vector<int32_t> out = decimateSine(f, 17, amp);
+  double peak = 0;
+  for (size_t k = out.size() / 2; k < out.size(); k++) peak = fmax(peak, fabs(double(out[k])));
+  return 20 * log10(peak / amp + 1e-9);
+}
+
+static void test_decimator_band_and_aliases(void) {
+  TEST_ASSERT_EQUAL(4 * FS * 20 / 4, decimateSine(10, 17).size()); // One output per 4 inputs
+  for (double f : {1.0, 10.0, 25.0}) TEST_ASSERT_DOUBLE_WITHIN(0.2, 0.0, decimatedDB(f)); // ECG band, untouched
+  // Everything that would fold back into the ECG band (0-25 Hz at 200 sps) is taken out
+  for (double f : {175.0, 190.0, 210.0, 225.0, 375.0, 390.0}) TEST_ASSERT_LESS_THAN(-50, decimatedDB(f));
+}
+
+// The phase carries over from a burst to the next: the burst length makes no difference
+static void test_decimator_bursts(void) {
+  const std::vector<int32_t> a = decimateSine(10, 5), b = decimateSine(10, 17), c = decimateSine(10, 32);
+  TEST_ASSERT_TRUE(a == b);
+  TEST_ASSERT_TRUE(b == c);
+}
+
+// The PPG CIC has a unity DC gain, on unsigned 19-bit samples
+static void test_cic_dc_gain(void) {
+  CICDecimator<int32_t, 3, 8> cic;
+  uint32_t x[64];
+  for (uint32_t& v : x) v = 0x7FFFF;
+  const uint16_t m = cic.decimate(x, 64);
+  TEST_ASSERT_EQUAL(8, m);
+  TEST_ASSERT_EQUAL_UINT32(0x7FFFF, x[m - 1]);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ecg_chain_response);
+  RUN_TEST(test_ecg_chain_fixed_point);
+  RUN_TEST(test_symmetric_fir_matches_reference);
+  RUN_TEST(test_benchmark_symmetric_fir);
+  RUN_TEST(test_decimator_band_and_aliases);
+  RUN_TEST(test_decimator_bursts);
+  RUN_TEST(test_cic_dc_gain);
+  return UNITY_END();
+}
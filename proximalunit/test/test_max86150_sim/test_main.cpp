@@ -0,0 +1,121 @@
+// MAX86150 driver against the register-level simulator, on the host (pio test -e native)
+#include <unity.h>
+#include <max86150.h>
+#include <max86150_sim.h>
+
+static SimulatedMAX86150 *sim;
+static MAX86150Driver<SimulatedMAX86150> *sensor;
+
+void setUp(void) {
+  sim = new SimulatedMAX86150();
+  sensor = new MAX86150Driver<SimulatedMAX86150>();
+}
+
+void tearDown(void) {
+  delete sensor;
+  delete sim;
+}
+
+// The example of max86150_sim.h, as is
+static void test_header_example(void) {
+  TEST_ASSERT_TRUE(sensor->begin(*sim, I2C_SPEED_FAST));
+  sensor->setup(MAX86150Config<>::registers);
+  sim->advance(100000);  //100ms worth of samples
+  const uint64_t before = sim->now();
+  const uint16_t n = sensor->check();
+
+  TEST_ASSERT_UINT32_WITHIN(1, 20, n); //200 sps
+  TEST_ASSERT_EQUAL(n, sensor->available());
+  TEST_ASSERT_GREATER_THAN(before, sim->now()); //The burst was charged to the virtual clock
+  TEST_ASSERT_EQUAL(0, sim->getFIFOCount());
+}
+
+// Timestamps come from the bus: the newest record is stamped with the virtual time of the check()
+static void test_timestamps_follow_virtual_clock(void) {
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  sensor->setup(MAX86150Config<>::registers);
+  sim->advance(50000);
+  sensor->check();
+
+  uint32_t last = 0;
+  while (sensor->available()) {
+    last = sensor->getFIFOTimestamp();
+    sensor->nextSample();
+  }
+  TEST_ASSERT_UINT32_WITHIN(5000, (uint32_t)sim->now(), last);
+}
+
+// softReset() and the read timeout wait on the virtual clock, and return in bounded virtual time
+static void test_waits_use_virtual_clock(void) {
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  const uint64_t t0 = sim->now();
+  sensor->softReset();
+  TEST_ASSERT_LESS_THAN(100000, sim->now() - t0);
+
+  sensor->shutDown(); //No new data: the armed read can only time out
+  sensor->requestSample(10);
+  const uint64_t t1 = sim->now();
+  MAX86150ReadStatus status;
+  while ((status = sensor->pollSample()) == MAX86150_READ_PENDING) sim->advance(1000);
+  TEST_ASSERT_EQUAL(MAX86150_READ_TIMEOUT, status);
+  TEST_ASSERT_UINT32_WITHIN(2000, 10000, sim->now() - t1);
+}
+
+// A channel change drops every sample taken with the old record layout, in the sensor and in the sense array
+static void test_set_channels_flushes_old_layout(void) {
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  sensor->setup(MAX86150Config<>::registers);
+  sim->advance(50000);
+  sensor->check();
+  TEST_ASSERT_GREATER_THAN(0, sensor->available());
+
+  sim->advance(20000); //Left in the sensor's FIFO
+  sensor->setChannels(MAX86150_CHANNELS_ECG);
+  TEST_ASSERT_EQUAL(0, sensor->available());
+  TEST_ASSERT_EQUAL(0, sim->getFIFOCount());
+
+  sim->advance(50000);
+  const uint16_t n = sensor->check();
+  TEST_ASSERT_EQUAL(n, sensor->available());
+  TEST_ASSERT_UINT32_WITHIN(1, 10, n);
+}
+
+// The blocking getters return as soon as a check() brings anything: at 3200 sps, every one brings a burst
+static void test_blocking_getter_takes_burst(void) {
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  sensor->setup(MAX86150Config<3200, 3200, 1, 50, 32768, 8, 95, 0xFF, 50, 15, MAX86150_CHANNELS_ECG>::registers);
+  sim->advance(5000);
+  const uint64_t t0 = sim->now();
+
+  sensor->getECG();
+  TEST_ASSERT_LESS_THAN(10000, sim->now() - t0); //Not the 250ms timeout
+  TEST_ASSERT_GREATER_THAN(1, sensor->available());
+}
+
+static void onInterrupt(void *arg) { (*static_cast<int *>(arg))++; }
+
+// The simulator drives its INT pin through the InterruptLine abstraction
+static void test_interrupt_line(void) {
+  int edges = 0;
+  sim->interruptLine().attach(onInterrupt, &edges);
+  sensor->begin(*sim, I2C_SPEED_FAST);
+  sensor->setup(MAX86150Config<>::registers);
+  sensor->enableAFULL();
+  sim->advance(200000);
+
+  TEST_ASSERT_EQUAL(1, edges); //Edge-triggered: one call until the flag is cleared
+  TEST_ASSERT_TRUE(sim->interruptLine().isAsserted());
+  sensor->getINT1(); //Reading the status clears it
+  TEST_ASSERT_FALSE(sim->interruptLine().isAsserted());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_example);
+  RUN_TEST(test_timestamps_follow_virtual_clock);
+  RUN_TEST(test_waits_use_virtual_clock);
+  RUN_TEST(test_set_channels_flushes_old_layout);
+  RUN_TEST(test_blocking_getter_takes_burst);
+  RUN_TEST(test_interrupt_line);
+  return UNITY_END();
+}
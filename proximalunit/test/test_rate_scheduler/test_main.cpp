@@ -0,0 +1,90 @@
+// RateScheduler on a virtual clock, on the host (pio test -e native)
+#include <unity.h>
+#include <AcquisitionScheduler.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Follows nextDue() up to `end` [us], as the timer would, and checks every dispatch against sampleTime()
+static void runTo(RateScheduler& scheduler, uint64_t end) {
+  while (scheduler.nextDue() <= end) {
+    const uint64_t t = scheduler.nextDue();
+    const uint32_t due = scheduler.advanceTo(t);
+    TEST_ASSERT_TRUE(due != 0);
+    for (uint8_t ch = 0; ch < scheduler.channels(); ch++)
+      if (due & (1UL << ch)) TEST_ASSERT_EQUAL_UINT64(scheduler.sampleTime(ch, scheduler.getCount(ch)), t);
+  }
+  scheduler.advanceTo(end);
+}
+
+// Rates that don't divide the timebase keep their exact average: no drift, within a channel or between channels
+static void test_fractional_rates_dont_drift(void) {
+  RateScheduler scheduler;
+  const int8_t a = scheduler.addChannel(220000);  // 4545.45 us
+  const int8_t b = scheduler.addChannel(200000);  // 5000 us
+  const int8_t c = scheduler.addChannel(333);     // 0.333 Hz
+  TEST_ASSERT_EQUAL(0, a);
+  TEST_ASSERT_EQUAL(1, b);
+  TEST_ASSERT_EQUAL(2, c);
+
+  runTo(scheduler, 3600ULL * 1000000); // One hour
+  TEST_ASSERT_EQUAL_UINT32(220 * 3600, scheduler.getCount(a));
+  TEST_ASSERT_EQUAL_UINT32(200 * 3600, scheduler.getCount(b));
+  TEST_ASSERT_EQUAL_UINT32(1198, scheduler.getCount(c)); // 3600 * 0.333
+  for (uint8_t ch = 0; ch < 3; ch++) TEST_ASSERT_EQUAL_UINT32(0, scheduler.getMissed(ch));
+
+  // Every 5 s, both audio-like channels land on the same microsecond
+  TEST_ASSERT_EQUAL_UINT64(scheduler.sampleTime(a, 1100), scheduler.sampleTime(b, 1000));
+}
+
+// The k-th dispatch happens at ceil(k / rate): single periods are rounded, but never accumulate the rounding
+static void test_dispatch_times(void) {
+  RateScheduler scheduler;
+  const int8_t ch = scheduler.addChannel(220000);
+  TEST_ASSERT_EQUAL_UINT32(4546, scheduler.period(ch));
+  TEST_ASSERT_EQUAL_UINT64(4546, scheduler.nextDue());
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.advanceTo(4545));
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler.advanceTo(4546));
+  TEST_ASSERT_EQUAL_UINT64(9091, scheduler.nextDue()); // 2 / 220 s = 9090.9 us
+}
+
+// A late advanceTo() merges the dispatches it skipped into one, and counts the others as missed
+static void test_missed_dispatches(void) {
+  RateScheduler scheduler;
+  const int8_t ch = scheduler.addChannel(100000); // 10 ms
+  TEST_ASSERT_EQUAL_UINT32(1, scheduler.advanceTo(35000));
+  TEST_ASSERT_EQUAL_UINT32(3, scheduler.getCount(ch));
+  TEST_ASSERT_EQUAL_UINT32(2, scheduler.getMissed(ch));
+  TEST_ASSERT_EQUAL_UINT64(40000, scheduler.nextDue()); // Back in phase
+}
+
+// A rate change stretches the period in progress, and numbering starts over at the new rate
+static void test_rate_change(void) {
+  RateScheduler scheduler;
+  const int8_t ch = scheduler.addChannel(100000); // 10 ms
+  runTo(scheduler, 25000);                       // Half way into the 3rd period
+  TEST_ASSERT_TRUE(scheduler.setRate(ch, 50000)); // 20 ms: the remaining half takes 10 ms
+  TEST_ASSERT_EQUAL_UINT64(35000, scheduler.nextDue());
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.getCount(ch));
+
+  runTo(scheduler, 35000 + 20000 * 99);
+  TEST_ASSERT_EQUAL_UINT32(100, scheduler.getCount(ch));
+  TEST_ASSERT_FALSE(scheduler.setRate(ch, 0));
+}
+
+static void test_channel_limits(void) {
+  RateScheduler scheduler;
+  TEST_ASSERT_EQUAL(-1, scheduler.addChannel(0));
+  for (int i = 0; i < SCHEDULER_MAX_CHANNELS; i++) TEST_ASSERT_EQUAL(i, scheduler.addChannel(1000));
+  TEST_ASSERT_EQUAL(-1, scheduler.addChannel(1000));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fractional_rates_dont_drift);
+  RUN_TEST(test_dispatch_times);
+  RUN_TEST(test_missed_dispatches);
+  RUN_TEST(test_rate_change);
+  RUN_TEST(test_channel_limits);
+  return UNITY_END();
+}
@@ -0,0 +1,158 @@
+// SPSCRing, on the host (pio test -e native), and its throughput in elements/s: on one thread (push a burst, then pop
+// it back) and across two threads (a producer and a consumer, popping one element or batches of 16 at a time)
+#include <unity.h>
+#include <SPSCRing.h>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_full_and_empty(void) {
+  SPSCRing<uint32_t, 8> ring;
+  uint32_t x;
+  TEST_ASSERT_FALSE(ring.pop(x));
+  for (uint32_t i = 0; i < 8; i++) TEST_ASSERT_TRUE(ring.push(i)); // A full ring holds all N elements
+  TEST_ASSERT_FALSE(ring.push(8));
+  TEST_ASSERT_EQUAL_UINT32(8, ring.size());
+
+  for (uint32_t i = 0; i < 8; i++) {
+    TEST_ASSERT_TRUE(ring.pop(x));
+    TEST_ASSERT_EQUAL_UINT32(i, x);
+  }
+  TEST_ASSERT_FALSE(ring.pop(x));
+  TEST_ASSERT_EQUAL_UINT32(8, ring.writeIndex());
+  TEST_ASSERT_EQUAL_UINT32(8, ring.readIndex());
+}
+
+// Batch pops come out in order across the wrap-around
+static void test_batch_pop_wraps(void) {
+  SPSCRing<uint32_t, 8> ring;
+  uint32_t next = 0, expected = 0;
+  uint32_t out[8];
+  for (int round = 0; round < 50; round++) {
+    while (ring.push(next)) next++;
+    const uint32_t n = ring.pop(out, 3 + round % 5);
+    for (uint32_t i = 0; i < n; i++) TEST_ASSERT_EQUAL_UINT32(expected++, out[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, ring.pop(out, 0));
+}
+
+// Windows of up to MIRROR elements are contiguous, even across the end of the buffer
+static void test_mirrored_windows(void) {
+  SPSCRing<uint16_t, 16, 5> ring;
+  for (uint16_t i = 0; i < 14; i++) ring.push(i);
+  ring.release(12); // Consumed in place
+  for (uint16_t i = 14; i < 19; i++) TEST_ASSERT_TRUE(ring.push(i));
+
+  const uint16_t* w = ring.window(12);
+  for (uint16_t i = 0; i < 7; i++) TEST_ASSERT_EQUAL_UINT16(12 + i, w[i]); // Slots 12..15, then 0..2 through the mirror
+  ring.release(19);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+}
+
+// One producer and one consumer thread, with no lock: every element arrives once, in order
+static void test_concurrent_producer_consumer(void) {
+  static SPSCRing<uint32_t, 64> ring;
+  const uint32_t count = 500000;
+  std::thread producer([&] {
+    for (uint32_t i = 0; i < count;)
+      if (ring.push(i)) i++;
+      else std::this_thread::yield(); // Full: let the consumer run, even on a single core
+  });
+
+  uint32_t expected = 0, errors = 0;
+  uint32_t out[16];
+  while (expected < count) {
+    const uint32_t n = (expected & 1) ? ring.pop(out, 16) : ring.pop(out[0]);
+    if (n == 0) std::this_thread::yield();
+    for (uint32_t i = 0; i < n; i++, expected++)
+      if (out[i] != expected) errors++;
+  }
+  producer.join();
+  TEST_ASSERT_EQUAL_UINT32(0, errors);
+  TEST_ASSERT_EQUAL_UINT32(count, ring.readIndex());
+}
+
+static const uint32_t BENCH_COUNT = 4000000;
+
+// Elements moved per second by `run`, which moves BENCH_COUNT of them
+template <class F>
+static double throughput(F run) {
+  const auto start = std::chrono::steady_clock::now();
+  run();
+  return BENCH_COUNT / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void test_benchmark_single_thread(void) {
+  static SPSCRing<uint32_t, 64> ring;
+  uint32_t sum = 0;
+  const double single = throughput([&] {
+    uint32_t x;
+    for (uint32_t i = 0; i < BENCH_COUNT; i += 32) {
+      for (uint32_t j = 0; j < 32; j++) ring.push(i + j);
+      for (uint32_t j = 0; j < 32; j++) {
+        ring.pop(x);
+        sum += x;
+      }
+    }
+  });
+  const double batch = throughput([&] {
+    uint32_t out[32];
+    for (uint32_t i = 0; i < BENCH_COUNT; i += 32) {
+      for (uint32_t j = 0; j < 32; j++) ring.push(i + j);
+      ring.pop(out, 32);
+      sum += out[31];
+    }
+  });
+
+  char line[128];
+  snprintf(line, sizeof(line), "SPSC ring, one thread: %.1f M elements/s popped one by one, %.1f M in batches of 32", single / 1e6, batch / 1e6);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.size());
+  TEST_ASSERT_GREATER_THAN(0, sum); // Keeps the loops from being optimized away
+}
+
+// Producer and consumer on two threads: elements/s through the ring, with `batch` elements per pop
+static double twoThreads(uint32_t batch) {
+  static SPSCRing<uint32_t, 256> ring;
+  uint32_t received = 0, errors = 0;
+  const double rate = throughput([&] {
+    std::thread producer([&] {
+      for (uint32_t i = 0; i < BENCH_COUNT;)
+        if (ring.push(i)) i++;
+        else std::this_thread::yield();
+    });
+    uint32_t out[16];
+    while (received < BENCH_COUNT) {
+      const uint32_t n = (batch == 1) ? ring.pop(out[0]) : ring.pop(out, batch);
+      if (n == 0) std::this_thread::yield();
+      for (uint32_t i = 0; i < n; i++, received++)
+        if (out[i] != received) errors++;
+    }
+    producer.join();
+  });
+  TEST_ASSERT_EQUAL_UINT32(0, errors);
+  return rate;
+}
+
+static void test_benchmark_two_threads(void) {
+  const double single = twoThreads(1);
+  const double batch = twoThreads(16);
+
+  char line[128];
+  snprintf(line, sizeof(line), "SPSC ring, two threads: %.1f M elements/s popped one by one, %.1f M in batches of 16", single / 1e6, batch / 1e6);
+  TEST_MESSAGE(line);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_and_empty);
+  RUN_TEST(test_batch_pop_wraps);
+  RUN_TEST(test_mirrored_windows);
+  RUN_TEST(test_concurrent_producer_consumer);
+  RUN_TEST(test_benchmark_single_thread);
+  RUN_TEST(test_benchmark_two_threads);
+  return UNITY_END();
+}
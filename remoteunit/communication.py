@@ -34,6 +34,7 @@ class MQTTManager:
         """
         pl = {
               "MQTT_TOPIC_PREFIX": cfg.MQTT_TOPIC_PREFIX,
+              "MAX86150_CHANNELS": cfg.MAX86150_CHANNELS,
               "BIOSIGNALS": cfg.BIOSIGNALS
              }
         pl = jsondumps(pl)
@@ -1,5 +1,7 @@
 # o-o-o-o ACQUISITION SYSTEM SETTINGS o-o-o-o #
 # NB!!! Make sure that 'fsample' is an integer multiple of 'fpacket' !!!
+# Optional 'filters': biquad chain run by the proximalunit on that signal, as [type, f0 [Hz], q (optional)] sections, up to 4.
+#   type: "lowpass", "highpass", "bandpass" or "notch". E.g. "filters": [["notch", 50], ["highpass", 0.5]]. [] clears the chain
 BIOSIGNALS: dict[str, dict[str, float]] = {"ECG": {
                                                    "fsample": 220,
                                                    "fpacket": 1.222,
@@ -44,6 +46,7 @@ BIOSIGNALS: dict[str, dict[str, float]] = {"ECG": {
                                              },
                                         }
 SIGNED_BIOSIGNALS = ["ECG"]
+MAX86150_CHANNELS: str = "PPG+ECG" # channels streamed by the MAX86150: "PPG+ECG", "PPG" or "ECG". ECG-only moves 3 bytes/sample on the I2C bus instead of 9, needed for ECG rates above 400 sps
 
 # o-o-o-o MQTT SETTINGS #
 MQTT_BROKER_ADDR: str = "localhost" # address of the MQTT broker